@@ -0,0 +1,219 @@
+#ifndef CONCURRENT_KVFIFO_H
+#define CONCURRENT_KVFIFO_H
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "kvfifo.h"
+
+using namespace std;
+
+// Queue of pairs of key and value for many producer and consumer threads,
+// keeping the order of kvfifo both between all elements and between
+// elements with the same key.
+// Keys are split by hash into stripes, each with its own lock. Every element
+// gets a ticket from a global counter while its stripe is locked, so tickets
+// grow along each stripe, and pop() takes the stripe whose first element has
+// the smallest ticket. First tickets of all stripes are kept next to each
+// other, so the scan reads a few cache lines, not one per stripe. The scan is
+// not atomic, an older element may be published in a stripe after the scan
+// passed it, but then before the oldest element found was, so only stripes
+// scanned before that one are looked at again. Operations on different
+// stripes do not wait for each other; the ticket counter is the only atomic
+// that pushes modify in common, and pops modify none.
+template<typename K, typename V>
+class concurrent_kvfifo {
+
+private:
+    //types
+    struct ticketed_value {
+        uint64_t ticket;
+        V value;
+    };
+
+    using stripe_fifo = kvfifo<K, ticketed_value, hashed_key_index>;
+
+    static constexpr uint64_t NO_TICKET = UINT64_MAX;
+
+    struct alignas(64) stripe {
+        mutex lock;
+        // written only with the lock held, read by size() without it
+        atomic<size_t> size{0};
+        stripe_fifo elements;
+    };
+
+    unique_ptr<stripe[]> stripes;
+
+    // ticket of the first element of each stripe, NO_TICKET if there is none
+    unique_ptr<atomic<uint64_t>[]> first_tickets;
+
+    size_t stripes_count;
+
+    int stripes_bits;
+
+    atomic<uint64_t> next_ticket{0};
+
+    // the index of a stripe uses the low bits of the same hash, so the
+    // stripe is chosen by the high ones
+    size_t stripe_of(K const &k) const {
+        return rotl(kvfifo_detail::mixed_hash(k), stripes_bits) & (stripes_count - 1);
+    }
+
+    // publishes the first ticket and the size of stripe i, its lock is held
+    void update_stripe(size_t i) noexcept {
+        stripe_fifo const &elements = stripes[i].elements;
+        first_tickets[i].store(elements.empty() ? NO_TICKET : elements.front().second.ticket,
+                               memory_order_release);
+        stripes[i].size.store(elements.size(), memory_order_relaxed);
+    }
+
+    // index of the stripe with the smallest first ticket among the first end
+    // ones, end if they all looked empty
+    size_t find_oldest(size_t end, uint64_t &oldest_ticket) const {
+        size_t oldest = end;
+        oldest_ticket = NO_TICKET;
+        for (size_t i = 0; i < end; i++) {
+            uint64_t ticket = first_tickets[i].load(memory_order_acquire);
+            if (ticket < oldest_ticket) {
+                oldest_ticket = ticket;
+                oldest = i;
+            }
+        }
+        return oldest;
+    }
+
+    static size_t default_stripes() noexcept {
+        return 4 * max<size_t>(thread::hardware_concurrency(), 1);
+    }
+
+public:
+
+    // number of stripes is rounded up to a power of two
+    explicit concurrent_kvfifo(size_t requested_stripes = default_stripes())
+        : stripes(make_unique<stripe[]>(bit_ceil(max<size_t>(requested_stripes, 1)))),
+          first_tickets(make_unique<atomic<uint64_t>[]>(bit_ceil(max<size_t>(requested_stripes, 1)))),
+          stripes_count(bit_ceil(max<size_t>(requested_stripes, 1))),
+          stripes_bits(countr_zero(stripes_count)) {
+        for (size_t i = 0; i < stripes_count; i++)
+            first_tickets[i].store(NO_TICKET, memory_order_relaxed);
+    }
+
+    concurrent_kvfifo(concurrent_kvfifo const &) = delete;
+
+    concurrent_kvfifo &operator=(concurrent_kvfifo const &) = delete;
+
+    void push(K const &k, V const &v) {
+        emplace(k, v);
+    }
+
+    void push(K &&k, V &&v) {
+        emplace(std::move(k), std::move(v));
+    }
+
+    template<typename Key, typename... Args>
+    void emplace(Key &&k, Args &&... args) {
+        size_t i = stripe_of(k);
+        stripe &s = stripes[i];
+        lock_guard<mutex> guard(s.lock);
+        uint64_t ticket = next_ticket.fetch_add(1, memory_order_relaxed);
+        s.elements.emplace(std::forward<Key>(k), ticketed_value{ticket, V(std::forward<Args>(args)...)});
+        if (s.elements.size() == 1)
+            first_tickets[i].store(ticket, memory_order_release);
+        s.size.store(s.elements.size(), memory_order_relaxed);
+    }
+
+    // removes the first element, nullopt if the queue is empty
+    optional<pair<K, V>> try_pop() {
+        while (true) {
+            //find stripe with the oldest first element
+            uint64_t pushed = next_ticket.load(memory_order_acquire);
+            uint64_t oldest_ticket;
+            size_t oldest = find_oldest(stripes_count, oldest_ticket);
+            if (oldest == stripes_count) {
+                //stripes were empty when looked at, unless a push came meanwhile
+                if (next_ticket.load(memory_order_acquire) == pushed)
+                    return nullopt;
+                this_thread::yield();
+                continue;
+            }
+
+            //an older element could have been published in a stripe scanned
+            //before the oldest one
+            uint64_t older_ticket;
+            find_oldest(oldest, older_ticket);
+            if (older_ticket < oldest_ticket)
+                continue;
+
+            //the element could have been taken in the meantime
+            stripe &s = stripes[oldest];
+            lock_guard<mutex> guard(s.lock);
+            if (first_tickets[oldest].load(memory_order_relaxed) != oldest_ticket)
+                continue;
+            //pop_n writes to the optional through a pointer to it
+            optional<pair<K, ticketed_value>> current;
+            s.elements.pop_n(1, &current);
+            update_stripe(oldest);
+            return optional<pair<K, V>>(in_place, std::move(current->first), std::move(current->second.value));
+        }
+    }
+
+    // removes the first element with key k, nullopt if there is none
+    optional<V> try_pop(K const &k) {
+        size_t i = stripe_of(k);
+        stripe &s = stripes[i];
+        lock_guard<mutex> guard(s.lock);
+        optional<ticketed_value> current = s.elements.try_pop(k);
+        if (!current)
+            return nullopt;
+        update_stripe(i);
+        return std::move(current->value);
+    }
+
+    pair<K, V> pop() {
+        auto result = try_pop();
+        if (!result)
+            throw invalid_argument("Empty fifo");
+        return std::move(*result);
+    }
+
+    V pop(K const &k) {
+        auto result = try_pop(k);
+        if (!result) {
+            if (empty())
+                throw invalid_argument("Empty fifo");
+            throw invalid_argument("No such key");
+        }
+        return std::move(*result);
+    }
+
+    // exact only while no other thread changes the queue
+    size_t size() const noexcept {
+        size_t result = 0;
+        for (size_t i = 0; i < stripes_count; i++)
+            result += stripes[i].size.load(memory_order_relaxed);
+        return result;
+    }
+
+    bool empty() const noexcept {
+        for (size_t i = 0; i < stripes_count; i++)
+            if (first_tickets[i].load(memory_order_acquire) != NO_TICKET)
+                return false;
+        return true;
+    }
+
+    size_t count(K const &k) const {
+        stripe &s = stripes[stripe_of(k)];
+        lock_guard<mutex> guard(s.lock);
+        return s.elements.count(k);
+    }
+};
+
+#endif // CONCURRENT_KVFIFO_H
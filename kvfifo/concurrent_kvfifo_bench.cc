@@ -0,0 +1,113 @@
+// Throughput of concurrent_kvfifo against kvfifo behind one mutex.
+// Build and run with:
+//     g++ -std=c++20 -O2 -pthread concurrent_kvfifo_bench.cc -o concurrent_kvfifo_bench
+//     ./concurrent_kvfifo_bench [operations per thread] [max threads]
+// Every thread pushes and pops in turn, for thread counts doubling up to max
+// threads, by default twice the number of hardware threads. Prints millions
+// of operations per second, which grows with threads only if they do not wait
+// for each other.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "concurrent_kvfifo.h"
+
+using namespace std;
+
+namespace {
+
+// Number of push and pop pairs done by each thread
+size_t operations = 1 << 18;
+
+// Number of different keys
+const size_t KEYS = 1024;
+
+// Elements pushed before measurement, so that pops do not find queue empty
+const size_t PREFILL = 4096;
+
+// kvfifo behind a global mutex, as it is used without concurrent_kvfifo
+class locked_kvfifo {
+private:
+    mutex lock;
+    kvfifo<size_t, size_t, hashed_key_index> elements;
+
+public:
+    void push(size_t k, size_t v) {
+        lock_guard<mutex> guard(lock);
+        elements.push(k, v);
+    }
+
+    bool try_pop() {
+        lock_guard<mutex> guard(lock);
+        if (elements.empty())
+            return false;
+        elements.pop();
+        return true;
+    }
+
+    bool try_pop(size_t k) {
+        lock_guard<mutex> guard(lock);
+        return elements.try_pop(k).has_value();
+    }
+};
+
+// Runs operation(thread, i) for every i on every thread, returns millions of
+// operations per second
+template<typename Operation>
+double run(size_t threads, Operation operation) {
+    vector<thread> workers;
+    const auto start = chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([&operation, t] {
+            for (size_t i = 0; i < operations; i++)
+                operation(t, i);
+        });
+    for (thread &worker : workers)
+        worker.join();
+    const auto end = chrono::steady_clock::now();
+    return 2.0 * threads * operations / chrono::duration<double, micro>(end - start).count();
+}
+
+template<typename Queue>
+void bench(const char *name, size_t threads) {
+    {
+        Queue queue;
+        for (size_t i = 0; i < PREFILL; i++)
+            queue.push(i % KEYS, i);
+        printf("%-12s %-14s %3zu threads %8.2f Mops/s\n", name, "push + pop", threads,
+               run(threads, [&queue](size_t t, size_t i) {
+                   queue.push((t * 7919 + i) % KEYS, i);
+                   queue.try_pop();
+               }));
+    }
+    {
+        Queue queue;
+        printf("%-12s %-14s %3zu threads %8.2f Mops/s\n", name, "push + pop(k)", threads,
+               run(threads, [&queue](size_t t, size_t i) {
+                   const size_t k = (t * 7919 + i) % KEYS;
+                   queue.push(k, i);
+                   queue.try_pop(k);
+               }));
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc > 1)
+        operations = max<size_t>(strtoull(argv[1], nullptr, 10), 1);
+    size_t max_threads = 2 * max<size_t>(thread::hardware_concurrency(), 1);
+    if (argc > 2)
+        max_threads = max<size_t>(strtoull(argv[2], nullptr, 10), 1);
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        bench<locked_kvfifo>("mutex", threads);
+        bench<concurrent_kvfifo<size_t, size_t>>("concurrent", threads);
+    }
+}
@@ -2,62 +2,613 @@
 #define KVFIFO_H
 
 #include <memory>
+#include <memory_resource>
 #include <map>
-#include <list>
+#include <vector>
 #include <iterator>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <cstdint>
+#include <optional>
 
 using namespace std;
 
-template<typename K, typename V>
+namespace kvfifo_detail {
+
+// allocates objects from slabs of growing size taken from a memory resource,
+// freed objects are reused
+template<typename T>
+class slab_pool {
+private:
+    struct free_object {
+        free_object *next;
+    };
+
+    struct slab {
+        slab *next;
+        size_t bytes;
+    };
+
+    static constexpr size_t OBJECT_SIZE =
+        (max(sizeof(T), sizeof(free_object)) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static constexpr size_t ALIGNMENT = max({alignof(T), alignof(slab), alignof(free_object)});
+    static constexpr size_t HEADER_SIZE = (sizeof(slab) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    static constexpr size_t MIN_SLAB_OBJECTS = 16;
+    static constexpr size_t MAX_SLAB_OBJECTS = 4096;
+
+    pmr::memory_resource *resource;
+    slab *slabs = nullptr;
+    free_object *free_objects = nullptr;
+    size_t free_count = 0;
+    size_t next_slab_objects = MIN_SLAB_OBJECTS;
+
+    void add_slab(size_t objects) {
+        size_t bytes = HEADER_SIZE + objects * OBJECT_SIZE;
+        char *memory = static_cast<char *>(resource->allocate(bytes, ALIGNMENT));
+        slabs = new (memory) slab{slabs, bytes};
+        for (size_t i = objects; i-- > 0;)
+            free_objects = new (memory + HEADER_SIZE + i * OBJECT_SIZE) free_object{free_objects};
+        free_count += objects;
+    }
+
+public:
+    explicit slab_pool(pmr::memory_resource *resource) noexcept : resource(resource) {}
+
+    slab_pool(slab_pool const &) = delete;
+
+    slab_pool &operator=(slab_pool const &) = delete;
+
+    // objects still in use have to be destroyed before
+    ~slab_pool() {
+        while (slabs != nullptr) {
+            slab *next = slabs->next;
+            resource->deallocate(slabs, slabs->bytes, ALIGNMENT);
+            slabs = next;
+        }
+    }
+
+    // next n objects will be created without allocation
+    void reserve(size_t n) {
+        if (n > free_count)
+            add_slab(max(n - free_count, MIN_SLAB_OBJECTS));
+    }
+
+    template<typename... Args>
+    T *create(Args &&... args) {
+        if (free_objects == nullptr) {
+            add_slab(next_slab_objects);
+            next_slab_objects = min(2 * next_slab_objects, MAX_SLAB_OBJECTS);
+        }
+        free_object *slot = free_objects;
+        free_objects = slot->next;
+        free_count--;
+        try {
+            return new (static_cast<void *>(slot)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            free_objects = new (static_cast<void *>(slot)) free_object{free_objects};
+            free_count++;
+            throw;
+        }
+    }
+
+    void destroy(T *object) noexcept {
+        object->~T();
+        free_objects = new (static_cast<void *>(object)) free_object{free_objects};
+        free_count++;
+    }
+};
+
+// polymorphic allocator which does not pass itself to constructed objects,
+// for objects like node handles that take an allocator but cannot use it
+template<typename T>
+struct plain_allocator : pmr::polymorphic_allocator<T> {
+    using pmr::polymorphic_allocator<T>::polymorphic_allocator;
+
+    template<typename U>
+    plain_allocator(plain_allocator<U> const &that) noexcept : pmr::polymorphic_allocator<T>(that.resource()) {}
+
+    template<typename U, typename... Args>
+    void construct(U *object, Args &&... args) {
+        new (static_cast<void *>(object)) U(std::forward<Args>(args)...);
+    }
+};
+
+// std::hash mixed so that all its bits are well spread; hashed_key_index
+// takes slots from the low bits, concurrent_kvfifo takes stripes from the
+// high ones, so that keys of one stripe do not cluster in its index
+template<typename K>
+uint64_t mixed_hash(K const &k) {
+    uint64_t h = hash<K>()(k);
+    h = (h ^ (h >> 32)) * 0x9e3779b97f4a7c15;
+    return h ^ (h >> 29);
+}
+
+} // namespace kvfifo_detail
+
+// Index of keys kept in std::map, k_iterator visits keys in increasing order.
+struct ordered_key_index {
+    template<typename K, typename Chain>
+    class type {
+    private:
+        using chains_map = pmr::map<K, Chain>;
+
+        chains_map chains;
+
+        // reusing a node assigns the new key to it, other keys are not
+        // required to be assignable, their nodes are freed
+        static constexpr bool REUSES_NODES = is_copy_assignable_v<K>;
+
+        // nodes of the map for keys no longer present, kept for reuse;
+        // capacity always suffices to take every node of the map
+        vector<typename chains_map::node_type,
+               kvfifo_detail::plain_allocator<typename chains_map::node_type>> spare_chains;
+
+    public:
+        explicit type(pmr::memory_resource *resource) : chains(resource), spare_chains(resource) {}
+
+        using iterator = typename chains_map::iterator;
+
+        static K const &key(iterator it) noexcept {
+            return it->first;
+        }
+
+        static Chain &chain(iterator it) noexcept {
+            return it->second;
+        }
+
+        iterator begin() noexcept {
+            return chains.begin();
+        }
+
+        iterator end() noexcept {
+            return chains.end();
+        }
+
+        iterator find(K const &k) {
+            return chains.find(k);
+        }
+
+        Chain &find_or_insert(K const &k) {
+            auto it = chains.lower_bound(k);
+            if (it != chains.end() && !chains.key_comp()(k, it->first))
+                return it->second;
+            if constexpr (REUSES_NODES) {
+                if (!spare_chains.empty()) {
+                    auto spare = std::move(spare_chains.back());
+                    spare_chains.pop_back();
+                    spare.key() = k;
+                    spare.mapped() = Chain();
+                    return chains.insert(it, std::move(spare))->second;
+                }
+                if (spare_chains.capacity() == chains.size())
+                    spare_chains.reserve(max<size_t>(2 * chains.size(), 16));
+            }
+            return chains.emplace_hint(it, k, Chain())->second;
+        }
+
+        void erase(iterator it) noexcept {
+            if constexpr (REUSES_NODES)
+                spare_chains.push_back(chains.extract(it));
+            else
+                chains.erase(it);
+        }
+
+        void clear() noexcept {
+            while (!chains.empty())
+                erase(chains.begin());
+        }
+    };
+};
+
+// Index of keys in a flat open addressing table using std::hash, for many
+// distinct keys. k_iterator visits keys in no particular order and is
+// invalidated when a key is added or removed.
+struct hashed_key_index {
+    template<typename K, typename Chain>
+    class type {
+    private:
+        // chain == nullptr marks an empty slot; chains are never empty while
+        // in the table, so their key is the key of their first element
+        struct slot {
+            Chain *chain = nullptr;
+            size_t hash = 0;
+        };
+
+        pmr::vector<slot> slots;
+
+        size_t count = 0;
+
+        // chains have stable addresses, as elements point to them
+        kvfifo_detail::slab_pool<Chain> chains;
+
+        size_t mask() const noexcept {
+            return slots.size() - 1;
+        }
+
+        static size_t hash_of(K const &k) {
+            return static_cast<size_t>(kvfifo_detail::mixed_hash(k));
+        }
+
+        // slot with key k or the empty slot ending its probe sequence
+        size_t probe(K const &k, size_t h) const {
+            size_t i = h & mask();
+            while (slots[i].chain != nullptr && !(slots[i].hash == h && slots[i].chain->key() == k))
+                i = (i + 1) & mask();
+            return i;
+        }
+
+        size_t empty_slot(size_t h) const noexcept {
+            size_t i = h & mask();
+            while (slots[i].chain != nullptr)
+                i = (i + 1) & mask();
+            return i;
+        }
+
+        void grow() {
+            pmr::vector<slot> bigger(max<size_t>(16, 2 * slots.size()), slots.get_allocator());
+            slots.swap(bigger);
+            for (slot const &s : bigger)
+                if (s.chain != nullptr)
+                    slots[empty_slot(s.hash)] = s;
+        }
+
+    public:
+        class iterator {
+        private:
+            friend class type;
+
+            type *table = nullptr;
+            size_t index = 0;
+
+            iterator(type *table, size_t index) noexcept : table(table), index(index) {}
+
+        public:
+            iterator() = default;
+
+            iterator &operator++() noexcept {
+                do
+                    index++;
+                while (index < table->slots.size() && table->slots[index].chain == nullptr);
+                return *this;
+            }
+
+            iterator &operator--() noexcept {
+                do
+                    index--;
+                while (table->slots[index].chain == nullptr);
+                return *this;
+            }
+
+            bool operator==(iterator const &that) const noexcept {
+                return index == that.index && table == that.table;
+            }
+
+            bool operator!=(iterator const &that) const noexcept {
+                return !(*this == that);
+            }
+        };
+
+        explicit type(pmr::memory_resource *resource) : slots(resource), chains(resource) {}
+
+        type(type const &) = delete;
+
+        type &operator=(type const &) = delete;
+
+        ~type() {
+            clear();
+        }
+
+        static K const &key(iterator it) noexcept {
+            return it.table->slots[it.index].chain->key();
+        }
+
+        static Chain &chain(iterator it) noexcept {
+            return *it.table->slots[it.index].chain;
+        }
+
+        iterator begin() noexcept {
+            iterator it(this, 0);
+            if (!slots.empty() && slots[0].chain == nullptr)
+                ++it;
+            return it;
+        }
+
+        iterator end() noexcept {
+            return iterator(this, slots.size());
+        }
+
+        iterator find(K const &k) {
+            if (count == 0)
+                return end();
+            size_t i = probe(k, hash_of(k));
+            return slots[i].chain != nullptr ? iterator(this, i) : end();
+        }
+
+        // new chain is empty, it has to get an element before next lookup
+        Chain &find_or_insert(K const &k) {
+            size_t h = hash_of(k);
+            size_t i = 0;
+            if (!slots.empty()) {
+                i = probe(k, h);
+                if (slots[i].chain != nullptr)
+                    return *slots[i].chain;
+            }
+            if ((count + 1) * 4 > slots.size() * 3) {
+                grow();
+                i = empty_slot(h);
+            }
+            slots[i] = slot{chains.create(), h};
+            count++;
+            return *slots[i].chain;
+        }
+
+        // backward shift deletion, so that no tombstones are left
+        void erase(iterator it) noexcept {
+            size_t i = it.index;
+            chains.destroy(slots[i].chain);
+            slots[i].chain = nullptr;
+            count--;
+            for (size_t j = (i + 1) & mask(); slots[j].chain != nullptr; j = (j + 1) & mask()) {
+                size_t home = slots[j].hash & mask();
+                if (((j - home) & mask()) >= ((j - i) & mask())) {
+                    slots[i] = slots[j];
+                    slots[j].chain = nullptr;
+                    i = j;
+                }
+            }
+        }
+
+        void clear() noexcept {
+            for (slot &s : slots) {
+                if (s.chain != nullptr) {
+                    chains.destroy(s.chain);
+                    s.chain = nullptr;
+                }
+            }
+            count = 0;
+        }
+    };
+};
+
+template<typename K, typename V, typename KeyIndex = ordered_key_index>
 class kvfifo {
 
 private:
     //types
     using KV = pair<K, V>;
-    using KV_list = list<KV>;
-    using KV_it = typename KV_list::iterator;
-    using KV_it_list = list<KV_it>;
-    using iterators_map = map<K, KV_it_list>;
-    using shared_it_map = shared_ptr<iterators_map>;
-    using shared_list = shared_ptr<KV_list>;
 
-    // map storing iterators of all elements with the same certain key
-    shared_it_map shr_key_iterators;
+    struct key_chain;
+
+    // element linked both into the main list and into the list of its key
+    struct element_node {
+        template<typename... Args>
+        explicit element_node(Args &&... args) : element(std::forward<Args>(args)...) {}
+
+        KV element;
+        element_node *prev = nullptr;
+        element_node *next = nullptr;
+        element_node *key_prev = nullptr;
+        element_node *key_next = nullptr;
+        key_chain *chain = nullptr;
+    };
+
+    // all elements with the same certain key, in their order
+    struct key_chain {
+        element_node *first = nullptr;
+        element_node *last = nullptr;
+        size_t count = 0;
 
-    // main list storing all elements in their order
-    shared_list shr_elements;
+        K const &key() const noexcept {
+            return first->element.first;
+        }
+    };
+
+    using chains_index = typename KeyIndex::template type<K, key_chain>;
+
+    // everything that copies of the queue share
+    struct storage {
+        kvfifo_detail::slab_pool<element_node> pool;
+        chains_index chains;
+        element_node *head = nullptr;
+        element_node *tail = nullptr;
+        size_t size = 0;
+
+        explicit storage(pmr::memory_resource *resource) : pool(resource), chains(resource) {}
+
+        storage(storage const &) = delete;
+
+        storage &operator=(storage const &) = delete;
+
+        ~storage() {
+            destroy_nodes();
+        }
+
+        void destroy_nodes() noexcept {
+            while (head != nullptr) {
+                element_node *next = head->next;
+                pool.destroy(head);
+                head = next;
+            }
+            tail = nullptr;
+            size = 0;
+        }
+
+        void append_to_order(element_node *node) noexcept {
+            node->prev = tail;
+            node->next = nullptr;
+            (tail != nullptr ? tail->next : head) = node;
+            tail = node;
+        }
+
+        void prepend_to_order(element_node *node) noexcept {
+            node->prev = nullptr;
+            node->next = head;
+            (head != nullptr ? head->prev : tail) = node;
+            head = node;
+        }
+
+        void unlink_from_order(element_node *node) noexcept {
+            (node->prev != nullptr ? node->prev->next : head) = node->next;
+            (node->next != nullptr ? node->next->prev : tail) = node->prev;
+        }
+
+        void link_back(element_node *node, key_chain &chain) noexcept {
+            append_to_order(node);
+            node->key_prev = chain.last;
+            node->key_next = nullptr;
+            (chain.last != nullptr ? chain.last->key_next : chain.first) = node;
+            chain.last = node;
+            node->chain = &chain;
+            chain.count++;
+            size++;
+        }
+
+        // removes node from both lists, its chain may become empty
+        void unlink(element_node *node) noexcept {
+            unlink_from_order(node);
+            key_chain &chain = *node->chain;
+            (node->key_prev != nullptr ? node->key_prev->key_next : chain.first) = node->key_next;
+            (node->key_next != nullptr ? node->key_next->key_prev : chain.last) = node->key_prev;
+            chain.count--;
+            size--;
+        }
+
+        // order within the chain stays the same, so only the main list changes
+        void move_chain_to_back(key_chain &chain) noexcept {
+            for (element_node *node = chain.first; node != nullptr; node = node->key_next) {
+                unlink_from_order(node);
+                append_to_order(node);
+            }
+        }
+
+        void move_chain_to_front(key_chain &chain) noexcept {
+            for (element_node *node = chain.last; node != nullptr; node = node->key_prev) {
+                unlink_from_order(node);
+                prepend_to_order(node);
+            }
+        }
+
+        // arguments construct the pair of key and value
+        template<typename... Args>
+        void emplace_back(Args &&... args) {
+            element_node *node = pool.create(std::forward<Args>(args)...);
+            try {
+                link_back(node, chains.find_or_insert(node->element.first));
+            } catch (...) {
+                pool.destroy(node);
+                throw;
+            }
+        }
+
+        // consume gets the first element before it is removed; the key is
+        // looked up only if it disappears, while its chain is not empty
+        template<typename Consumer>
+        void pop_front(Consumer &&consume) {
+            element_node *node = head;
+            if (node->chain->count == 1) {
+                auto it = chains.find(node->element.first);
+                consume(node->element);
+                unlink(node);
+                chains.erase(it);
+            } else {
+                consume(node->element);
+                unlink(node);
+            }
+            pool.destroy(node);
+        }
+
+        // consume gets the first element of the chain before it is removed
+        template<typename Consumer>
+        void pop_first(typename chains_index::iterator it, Consumer &&consume) {
+            element_node *node = chains_index::chain(it).first;
+            consume(node->element);
+            unlink(node);
+            if (node->chain->count == 0)
+                chains.erase(it);
+            pool.destroy(node);
+        }
+    };
+
+    using shared_storage = shared_ptr<storage>;
+
+    // all elements in their order together with chains of elements of every key
+    shared_storage shr_storage;
+
+    // memory of elements, keys and the shared storage itself, also of copies
+    pmr::memory_resource *resource = pmr::get_default_resource();
 
     bool is_it_changed = false;
 
-    void copy_everything() {
+    shared_storage make_storage() const {
+        return allocate_shared<storage>(pmr::polymorphic_allocator<storage>(resource), resource);
+    }
+
+    // returns whether the elements were copied
+    bool copy_everything() {
         try {
-            if (shr_elements.use_count() > 1 || shr_key_iterators.use_count() > 1) {
-                shared_list new_elements = make_shared<KV_list>();
-                shared_it_map new_key_iterators = make_shared<iterators_map>();
-                for (auto it = shr_elements->begin();
-                     it != shr_elements->end(); ++it) {
-                    new_elements.get()->push_back(*it);
-                    auto new_it = new_elements.get()->end();
-                    new_it--;
-                    (*new_key_iterators)[it->first].push_back(new_it);
-                }
-                swap(shr_elements, new_elements);
-                swap(shr_key_iterators, new_key_iterators);
+            if (shr_storage.use_count() > 1) {
+                shared_storage new_storage = make_storage();
+                new_storage->pool.reserve(shr_storage->size);
+                for (element_node *node = shr_storage->head; node != nullptr; node = node->next)
+                    new_storage->emplace_back(node->element.first, node->element.second);
+                swap(shr_storage, new_storage);
                 is_it_changed = false;
+                return true;
             }
+            return false;
         } catch (...) {
             throw;
         }
     }
 
+    typename chains_index::iterator find_chain(K const &k) const {
+        if (empty())
+            throw invalid_argument("Empty fifo");
+        auto it = shr_storage->chains.find(k);
+        if (it == shr_storage->chains.end())
+            throw invalid_argument("No such key");
+        return it;
+    }
+
+    // storage is allocated lazily, on the first push
+    void prepare_storage() {
+        if (shr_storage == nullptr)
+            shr_storage = make_storage();
+        else
+            copy_everything();
+    }
+
+    // finds chain of key k in elements no longer shared with other queues
+    typename chains_index::iterator find_own_chain(K const &k) {
+        auto it = find_chain(k);
+        try {
+            if (copy_everything())
+                it = shr_storage->chains.find(k);
+        } catch (...) {
+            throw;
+        }
+        return it;
+    }
+
 public:
 
-    kvfifo() : shr_key_iterators(make_shared<iterators_map>()),
-               shr_elements(make_shared<KV_list>()) {};
+    class k_iterator;
+
+    // empty queue owns no storage, so it does not allocate
+    kvfifo() noexcept = default;
 
-    kvfifo(kvfifo const &that) {
-        shr_key_iterators = that.shr_key_iterators;
-        shr_elements = that.shr_elements;
+    // everything the queue allocates comes from resource, which has to
+    // outlive the queue and all copies of it
+    explicit kvfifo(pmr::memory_resource *resource) noexcept : resource(resource) {}
+
+    // copy uses the same resource as that
+    kvfifo(kvfifo const &that) : resource(that.resource) {
+        shr_storage = that.shr_storage;
         if (that.is_it_changed) {
             try {
                 copy_everything();
@@ -67,59 +618,107 @@ public:
         }
     }
 
-    kvfifo(kvfifo &&that) noexcept: shr_key_iterators(move(that.shr_key_iterators)),
-                                    shr_elements(move(that.shr_elements)),
-                                    is_it_changed(move(that.is_it_changed)) {
-        that = kvfifo();
-    };
-
-    kvfifo &operator=(kvfifo other) {
-        swap(shr_key_iterators, other.shr_key_iterators);
-        swap(shr_elements, other.shr_elements);
-        if (other.is_it_changed) {
-            try {
-                copy_everything();
-            } catch (...) {
-                throw;
+    // moved-from queue is empty and owns no storage
+    kvfifo(kvfifo &&that) noexcept: shr_storage(std::move(that.shr_storage)), resource(that.resource),
+                                    is_it_changed(exchange(that.is_it_changed, false)) {}
+
+    // assigned queue keeps its resource, elements from another one are copied
+    kvfifo &operator=(kvfifo const &that) {
+        if (this != &that) {
+            kvfifo copy(resource);
+            copy.shr_storage = that.shr_storage;
+            if (that.is_it_changed || (that.shr_storage != nullptr && *resource != *that.resource)) {
+                try {
+                    copy.copy_everything();
+                } catch (...) {
+                    throw;
+                }
             }
+            swap(shr_storage, copy.shr_storage);
+            is_it_changed = false;
         }
         return *this;
     }
 
+    // moved elements stay where they are, so the resource of that comes with them
+    kvfifo &operator=(kvfifo &&that) noexcept {
+        if (this != &that) {
+            shr_storage = std::move(that.shr_storage);
+            resource = that.resource;
+            is_it_changed = exchange(that.is_it_changed, false);
+        }
+        return *this;
+    }
+
+    pmr::memory_resource *get_memory_resource() const noexcept {
+        return resource;
+    }
+
     void push(K const &k, V const &v) {
-        //copy everything if needed
+        emplace(k, v);
+    }
+
+    void push(K &&k, V &&v) {
+        emplace(std::move(k), std::move(v));
+    }
+
+    // value of the new element is constructed from args
+    template<typename Key, typename... Args>
+    void emplace(Key &&k, Args &&... args) {
+        //allocate or copy everything if needed
         try {
-            copy_everything();
+            prepare_storage();
         } catch (...) {
             throw;
         }
 
-        //add new element to the end of the list and to map
-        KV new_element = make_pair(k, v);
+        //add new element to the end of the list and of the chain of its key
+        shr_storage->emplace_back(piecewise_construct, forward_as_tuple(std::forward<Key>(k)),
+                                  forward_as_tuple(std::forward<Args>(args)...));
+        is_it_changed = false;
+    }
+
+    // pushes pairs of key and value from [first, last), all or none of them
+    template<typename InputIt>
+    void push_range(InputIt first, InputIt last) {
+        if (first == last)
+            return;
+
+        //allocate or copy everything once for the whole range
         try {
-            shr_elements->push_back(new_element);
+            prepare_storage();
         } catch (...) {
             throw;
         }
-        auto current_iterator = shr_elements->end();
-        --current_iterator;
-        auto it = shr_key_iterators.get()->find(k);
-        if (it == shr_key_iterators.get()->end()) {
-            shr_key_iterators.get()->insert({k, KV_it_list()});
-            it = shr_key_iterators.get()->find(k);
-        }
+
+        size_t pushed = 0;
         try {
-            it->second.push_back(current_iterator);
+            if constexpr (is_base_of_v<forward_iterator_tag,
+                                       typename iterator_traits<InputIt>::iterator_category>)
+                shr_storage->pool.reserve(static_cast<size_t>(distance(first, last)));
+            for (; first != last; ++first, ++pushed)
+                shr_storage->emplace_back(first->first, first->second);
         } catch (...) {
-            // queue does not change
-            shr_elements->pop_back();
+            //take back elements pushed so far
+            for (; pushed > 0; pushed--) {
+                element_node *node = shr_storage->tail;
+                typename chains_index::iterator it;
+                bool disappears = node->chain->count == 1;
+                if (disappears)
+                    it = shr_storage->chains.find(node->element.first);
+                shr_storage->unlink(node);
+                if (disappears)
+                    shr_storage->chains.erase(it);
+                shr_storage->pool.destroy(node);
+            }
+            throw;
         }
         is_it_changed = false;
-    };
+    }
 
     void pop() {
         //check exceptions
-        if (shr_elements.get()->size() == 0)
+        if (empty())
             throw std::invalid_argument("Empty fifo");
 
         //copy everything if needed
@@ -129,72 +728,107 @@ public:
             throw;
         }
 
-        auto current_iterator = shr_elements->begin();
-        K k = current_iterator->first;
-        shr_elements->pop_front();
-        shr_key_iterators.get()->at(k).pop_front();
-        if (shr_key_iterators.get()->at(k).empty())
-            shr_key_iterators.get()->erase(k);
+        shr_storage->pop_front([](KV &) {});
         is_it_changed = false;
     };
 
-    void pop(K const &k) {
+    // moves n first elements to out as pairs of key and value and removes them;
+    // if writing to out throws, elements written before stay removed
+    template<typename OutputIt>
+    OutputIt pop_n(size_t n, OutputIt out) {
         //check exceptions
-        if (shr_elements->size() == 0)
+        if (n > size())
             throw invalid_argument("Empty fifo");
-        if (shr_key_iterators->find(k) == shr_key_iterators->end()
-            || shr_key_iterators->at(k).size() == 0)
-            throw invalid_argument("No such key");
 
-        //copy everything if needed
+        //copy everything once for all elements
         try {
             copy_everything();
         } catch (...) {
             throw;
         }
 
-        auto current_iterator = shr_key_iterators->at(k).begin();
-        shr_elements->erase(*current_iterator);
-        shr_key_iterators->at(k).pop_front();
-        if (shr_key_iterators->at(k).size() == 0)
-            shr_key_iterators->erase(k);
+        for (size_t i = 0; i < n; i++) {
+            shr_storage->pop_front([&out](KV &element) {
+                *out = std::move(element);
+                ++out;
+            });
+        }
+        is_it_changed = false;
+        return out;
+    }
+
+    void pop(K const &k) {
+        auto it = find_own_chain(k);
+        shr_storage->pop_first(it, [](KV &) {});
         is_it_changed = false;
     };
 
-    void move_to_back(K const &k) {
-        if (shr_elements->size() == 0)
-            throw invalid_argument("Empty fifo");
-        if (shr_key_iterators->find(k) == shr_key_iterators->end()
-            || shr_key_iterators->at(k).size() == 0)
-            throw invalid_argument("No such key");
+    // removes the first element with key k and returns its value, nullopt if
+    // there is none; looks the key up once, unlike count(k) followed by pop(k)
+    optional<V> try_pop(K const &k) {
+        if (empty())
+            return nullopt;
+        auto it = shr_storage->chains.find(k);
+        if (it == shr_storage->chains.end())
+            return nullopt;
 
         //copy everything if needed
         try {
-            copy_everything();
+            if (copy_everything())
+                it = shr_storage->chains.find(k);
+        } catch (...) {
+            throw;
+        }
+
+        optional<V> result;
+        shr_storage->pop_first(it, [&result](KV &element) { result.emplace(std::move(element.second)); });
+        is_it_changed = false;
+        return result;
+    }
+
+    void move_to_back(K const &k) {
+        auto it = find_own_chain(k);
+        shr_storage->move_chain_to_back(chains_index::chain(it));
+        is_it_changed = false;
+    }
+
+    void move_to_front(K const &k) {
+        auto it = find_own_chain(k);
+        shr_storage->move_chain_to_front(chains_index::chain(it));
+        is_it_changed = false;
+    }
+
+    // moves elements of every key from [first, last) to the back, key after key,
+    // as if move_to_back was called for each of them
+    void move_range(k_iterator first, k_iterator last) {
+        if (first == last)
+            return;
+
+        //keys of the range, as order of keys in a copy may differ
+        vector<K const *> keys;
+        if (shr_storage.use_count() > 1)
+            for (k_iterator it = first; it != last; ++it)
+                keys.push_back(&*it);
+
+        //copy everything if needed, old elements stay alive in other queues
+        try {
+            if (copy_everything()) {
+                for (K const *k : keys)
+                    shr_storage->move_chain_to_back(chains_index::chain(shr_storage->chains.find(*k)));
+                is_it_changed = false;
+                return;
+            }
         } catch (...) {
             throw;
         }
 
-        KV_it_list &this_k_iterators = shr_key_iterators.get()->at(k);
-        KV_it_list new_k_iterators;
-        int ile = 0;
-        for (typename KV_it_list::iterator it = this_k_iterators.begin(); it != this_k_iterators.end();) {
-            ile++;
-            KV_it current_iterator = *it;
-            KV current_element = *current_iterator;
-            shr_elements->erase(current_iterator);
-            shr_elements->push_back(current_element);
-            auto new_iterator = shr_elements.get()->end();
-            new_iterator--;
-            it = this_k_iterators.erase(it);
-            new_k_iterators.push_back(new_iterator);
-        }
-        this_k_iterators = new_k_iterators;
+        for (auto it = first.my_iterator; it != last.my_iterator; ++it)
+            shr_storage->move_chain_to_back(chains_index::chain(it));
         is_it_changed = false;
     }
 
     std::pair<K const &, V &> front() {
-        if (shr_elements.get()->size() == 0)
+        if (empty())
             throw invalid_argument("Empty fifo");
         else {
             try {
@@ -203,22 +837,22 @@ public:
                 throw;
             }
             is_it_changed = true;
-            auto current_iterator = shr_elements->begin();
-            return {current_iterator->first, current_iterator->second};
+            KV &current = shr_storage->head->element;
+            return {current.first, current.second};
         }
     }
 
     std::pair<K const &, V const &> front() const {
-        if (shr_elements.get()->size() == 0)
+        if (empty())
             throw std::invalid_argument("Empty fifo");
         else {
-            auto current_iterator = shr_elements->begin();
-            return {current_iterator->first, current_iterator->second};
+            KV const &current = shr_storage->head->element;
+            return {current.first, current.second};
         }
     }
 
     std::pair<K const &, V &> back() {
-        if (shr_elements.get()->size() == 0)
+        if (empty())
             throw std::invalid_argument("Empty fifo");
         else {
             try {
@@ -227,84 +861,46 @@ public:
                 throw;
             }
             is_it_changed = true;
-            auto current_iterator = shr_elements->end();
-            current_iterator--;
-            return {current_iterator->first, current_iterator->second};
+            KV &current = shr_storage->tail->element;
+            return {current.first, current.second};
         }
     }
 
     std::pair<K const &, V const &> back() const {
-        if (shr_elements.get()->size() == 0)
+        if (empty())
             throw invalid_argument("Empty fifo");
         else {
-            auto current_iterator = shr_elements->end();
-            current_iterator--;
-            return {current_iterator->first, current_iterator->second};
+            KV const &current = shr_storage->tail->element;
+            return {current.first, current.second};
         }
     }
 
     std::pair<K const &, V &> first(K const &k) {
-        if (shr_elements->size() == 0)
-            throw invalid_argument("Empty fifo");
-        auto current_iterator = shr_key_iterators.get()->find(k);
-        if (current_iterator == shr_key_iterators->end()
-            || shr_key_iterators->at(k).size() == 0)
-            throw invalid_argument("No such key");
-        else {
-            try {
-                copy_everything();
-            } catch (...) {
-                throw;
-            }
-            is_it_changed = true;
-            return {k, shr_key_iterators.get()->at(k).front()->second};
-        }
+        auto it = find_own_chain(k);
+        is_it_changed = true;
+        KV &current = chains_index::chain(it).first->element;
+        return {current.first, current.second};
     }
 
     std::pair<K const &, V const &> first(K const &k) const {
-        auto current_iterator = shr_key_iterators.get()->find(k);
-        if (shr_elements->size() == 0)
-            throw invalid_argument("Empty fifo");
-        if (current_iterator == shr_key_iterators->end()
-            || shr_key_iterators->at(k).size() == 0)
-            throw invalid_argument("No such key");
-        else {
-            return {k, current_iterator->second.front()->second};
-        }
+        KV const &current = chains_index::chain(find_chain(k)).first->element;
+        return {current.first, current.second};
     }
 
     std::pair<K const &, V &> last(K const &k) {
-        auto current_iterator = shr_key_iterators->find(k);
-        if (shr_elements->size() == 0)
-            throw invalid_argument("Empty fifo");
-        if (current_iterator == shr_key_iterators->end()
-            || shr_key_iterators->at(k).size() == 0)
-            throw invalid_argument("No such key");
-        else {
-            try {
-                copy_everything();
-            } catch (...) {
-                throw;
-            }
-            is_it_changed = true;
-            return {k, shr_key_iterators.get()->at(k).back()->second};
-        }
+        auto it = find_own_chain(k);
+        is_it_changed = true;
+        KV &current = chains_index::chain(it).last->element;
+        return {current.first, current.second};
     }
 
     std::pair<K const &, V const &> last(K const &k) const {
-        auto current_iterator = shr_key_iterators->find(k);
-        if (shr_elements->size() == 0)
-            throw invalid_argument("Empty fifo");
-        if (current_iterator == shr_key_iterators->end()
-            || shr_key_iterators->at(k).size() == 0)
-            throw invalid_argument("No such key");
-        else {
-            return {k, current_iterator->second.back()->second};
-        }
+        KV const &current = chains_index::chain(find_chain(k)).last->element;
+        return {current.first, current.second};
     }
 
     size_t size() const noexcept {
-        return shr_elements.get()->size();
+        return shr_storage != nullptr ? shr_storage->size : 0;
     }
 
     bool empty() const noexcept {
@@ -312,18 +908,24 @@ public:
     }
 
     size_t count(K const &k) const {
-        auto it = shr_key_iterators.get()->find(k);
-        if (it == shr_key_iterators.get()->end())
+        if (empty())
+            return 0;
+        auto it = shr_storage->chains.find(k);
+        if (it == shr_storage->chains.end())
             return 0;
         else
-            return it->second.size();
+            return chains_index::chain(it).count;
     }
 
     void clear() {
         try {
-            copy_everything();
-            shr_elements->clear();
-            shr_key_iterators->clear();
+            if (shr_storage.use_count() > 1) {
+                shr_storage = nullptr;
+            } else if (shr_storage != nullptr) {
+                shr_storage->destroy_nodes();
+                shr_storage->chains.clear();
+            }
+            is_it_changed = false;
         } catch (...) {
             throw;
         }
@@ -331,8 +933,10 @@ public:
 
     class k_iterator {
     private:
-        using k_iterator_t = typename iterators_map::iterator;
-        k_iterator_t my_iterator;
+        friend class kvfifo;
+
+        using k_iterator_t = typename chains_index::iterator;
+        k_iterator_t my_iterator{};
 
     public:
         using iterator_category = std::bidirectional_iterator_tag;
@@ -346,10 +950,10 @@ public:
         k_iterator() = default;
 
         //dereference operator for iterator returns key
-        const K &operator*() const { return my_iterator->first; }
+        const K &operator*() const { return chains_index::key(my_iterator); }
 
         k_iterator &operator++() {
-            my_iterator++;
+            ++my_iterator;
             return *this;
         }
 
@@ -360,7 +964,7 @@ public:
         }
 
         k_iterator &operator--() {
-            my_iterator--;
+            --my_iterator;
             return *this;
         }
 
@@ -370,22 +974,22 @@ public:
             return tmp;
         }
 
-        bool operator==(const kvfifo<K, V>::k_iterator &that) const {
+        bool operator==(const kvfifo<K, V, KeyIndex>::k_iterator &that) const {
             return my_iterator == that.my_iterator;
         }
 
-        bool operator!=(const kvfifo<K, V>::k_iterator &that) const {
+        bool operator!=(const kvfifo<K, V, KeyIndex>::k_iterator &that) const {
             return !(*this == that);
         }
     };
 
 
     k_iterator k_begin() const noexcept {
-        return k_iterator(shr_key_iterators->begin());
+        return shr_storage != nullptr ? k_iterator(shr_storage->chains.begin()) : k_iterator();
     }
 
     k_iterator k_end() const noexcept {
-        return k_iterator(shr_key_iterators->end());
+        return shr_storage != nullptr ? k_iterator(shr_storage->chains.end()) : k_iterator();
     }
 };
 
@@ -0,0 +1,523 @@
+#ifndef PERSISTENT_KVFIFO_H
+#define PERSISTENT_KVFIFO_H
+
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+
+using namespace std;
+
+// Queue with the interface of kvfifo in which copies share structure.
+// Copying takes O(1) and every later change copies O(log n) nodes,
+// so snapshots of large queues are cheap.
+template<typename K, typename V>
+class persistent_kvfifo {
+
+private:
+    //types
+    using KV = pair<K, V>;
+
+    // treap whose nodes are shared between versions of the queue,
+    // every change copies only nodes on its path from the root
+    template<typename Key, typename Value>
+    struct treap {
+        struct node;
+        using node_ptr = shared_ptr<node>;
+
+        struct node {
+            Key key;
+            Value value;
+            uint64_t priority;
+            node_ptr left;
+            node_ptr right;
+        };
+
+        static uint64_t random_priority() noexcept {
+            static thread_local uint64_t state = 0;
+            uint64_t z = (state += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+        static node_ptr clone(node const &n) {
+            return make_shared<node>(n);
+        }
+
+        static node const *find(node const *root, Key const &key) {
+            while (root != nullptr) {
+                if (key < root->key)
+                    root = root->left.get();
+                else if (root->key < key)
+                    root = root->right.get();
+                else
+                    return root;
+            }
+            return nullptr;
+        }
+
+        static node const *minimum(node const *root) noexcept {
+            while (root->left != nullptr)
+                root = root->left.get();
+            return root;
+        }
+
+        static node const *maximum(node const *root) noexcept {
+            while (root->right != nullptr)
+                root = root->right.get();
+            return root;
+        }
+
+        // splits into keys less than key and the rest
+        static pair<node_ptr, node_ptr> split(node_ptr const &root, Key const &key) {
+            if (root == nullptr)
+                return {};
+            node_ptr copy = clone(*root);
+            if (root->key < key) {
+                auto [left, right] = split(root->right, key);
+                copy->right = std::move(left);
+                return {std::move(copy), std::move(right)};
+            } else {
+                auto [left, right] = split(root->left, key);
+                copy->left = std::move(right);
+                return {std::move(left), std::move(copy)};
+            }
+        }
+
+        // all keys of left have to be less than keys of right
+        static node_ptr merge(node_ptr const &left, node_ptr const &right) {
+            if (left == nullptr)
+                return right;
+            if (right == nullptr)
+                return left;
+            if (left->priority > right->priority) {
+                node_ptr copy = clone(*left);
+                copy->right = merge(left->right, right);
+                return copy;
+            } else {
+                node_ptr copy = clone(*right);
+                copy->left = merge(left, right->left);
+                return copy;
+            }
+        }
+
+        // key must not be present
+        static node_ptr insert(node_ptr const &root, Key const &key, Value const &value,
+                               uint64_t priority) {
+            if (root == nullptr || priority > root->priority) {
+                auto [left, right] = split(root, key);
+                return make_shared<node>(node{key, value, priority, std::move(left), std::move(right)});
+            }
+            node_ptr copy = clone(*root);
+            if (key < root->key)
+                copy->left = insert(root->left, key, value, priority);
+            else
+                copy->right = insert(root->right, key, value, priority);
+            return copy;
+        }
+
+        static node_ptr insert(node_ptr const &root, Key const &key, Value const &value) {
+            return insert(root, key, value, random_priority());
+        }
+
+        // key must be present
+        static node_ptr erase(node_ptr const &root, Key const &key) {
+            if (key < root->key) {
+                node_ptr copy = clone(*root);
+                copy->left = erase(root->left, key);
+                return copy;
+            } else if (root->key < key) {
+                node_ptr copy = clone(*root);
+                copy->right = erase(root->right, key);
+                return copy;
+            } else {
+                return merge(root->left, root->right);
+            }
+        }
+
+        // key must be present
+        static node_ptr assign(node_ptr const &root, Key const &key, Value const &value) {
+            node_ptr copy = clone(*root);
+            if (key < root->key)
+                copy->left = assign(root->left, key, value);
+            else if (root->key < key)
+                copy->right = assign(root->right, key, value);
+            else
+                copy->value = value;
+            return copy;
+        }
+
+        // copies nodes on the path to key that are shared with other versions;
+        // key must be present
+        static node *unshare(node_ptr &root, Key const &key) {
+            node_ptr *current = &root;
+            while (true) {
+                if (current->use_count() > 1)
+                    *current = clone(**current);
+                node &n = **current;
+                if (key < n.key)
+                    current = &n.left;
+                else if (n.key < key)
+                    current = &n.right;
+                else
+                    return &n;
+            }
+        }
+
+        // keys in increasing order
+        static vector<Key> keys(node const *root) {
+            vector<Key> result;
+            vector<node const *> path;
+            while (root != nullptr || !path.empty()) {
+                while (root != nullptr) {
+                    path.push_back(root);
+                    root = root->left.get();
+                }
+                root = path.back();
+                path.pop_back();
+                result.push_back(root->key);
+                root = root->right.get();
+            }
+            return result;
+        }
+    };
+
+    struct nothing {};
+
+    // numbers of elements, which give their order in the queue
+    using sequence_treap = treap<uint64_t, nothing>;
+    using elements_treap = treap<uint64_t, shared_ptr<KV>>;
+
+    // sequence numbers of all elements with the same certain key
+    struct key_entry {
+        typename sequence_treap::node_ptr sequences;
+        size_t count = 0;
+    };
+
+    using keys_treap = treap<K, key_entry>;
+
+    // elements in their order
+    typename elements_treap::node_ptr elements;
+
+    typename keys_treap::node_ptr keys;
+
+    size_t elements_count = 0;
+
+    uint64_t next_sequence = 0;
+
+    // sequence numbers of elements given out by non-const references
+    vector<uint64_t> changed_sequences;
+
+    bool is_it_changed = false;
+
+    // makes elements given out by references not shared with other queues
+    void copy_changed() {
+        for (uint64_t sequence : changed_sequences) {
+            auto node = elements_treap::unshare(elements, sequence);
+            if (node->value.use_count() > 1)
+                node->value = make_shared<KV>(*node->value);
+        }
+    }
+
+    std::pair<K const &, V &> changeable(uint64_t sequence) {
+        auto node = elements_treap::unshare(elements, sequence);
+        if (node->value.use_count() > 1)
+            node->value = make_shared<KV>(*node->value);
+        if (changed_sequences.empty() || changed_sequences.back() != sequence)
+            changed_sequences.push_back(sequence);
+        is_it_changed = true;
+        return {node->value->first, node->value->second};
+    }
+
+    std::pair<K const &, V const &> element(uint64_t sequence) const {
+        KV const &current = *elements_treap::find(elements.get(), sequence)->value;
+        return {current.first, current.second};
+    }
+
+    void changed() noexcept {
+        changed_sequences.clear();
+        is_it_changed = false;
+    }
+
+    key_entry const &existing_entry(K const &k) const {
+        if (elements_count == 0)
+            throw invalid_argument("Empty fifo");
+        auto entry = keys_treap::find(keys.get(), k);
+        if (entry == nullptr)
+            throw invalid_argument("No such key");
+        return entry->value;
+    }
+
+    // removes element with given sequence number and key with entry
+    void erase(uint64_t sequence, K const &k, key_entry const &entry) {
+        auto new_elements = elements_treap::erase(elements, sequence);
+        typename keys_treap::node_ptr new_keys;
+        if (entry.count == 1) {
+            new_keys = keys_treap::erase(keys, k);
+        } else {
+            key_entry new_entry{sequence_treap::erase(entry.sequences, sequence), entry.count - 1};
+            new_keys = keys_treap::assign(keys, k, new_entry);
+        }
+        elements = std::move(new_elements);
+        keys = std::move(new_keys);
+        elements_count--;
+        changed();
+    }
+
+public:
+
+    persistent_kvfifo() = default;
+
+    persistent_kvfifo(persistent_kvfifo const &that)
+        : elements(that.elements), keys(that.keys),
+          elements_count(that.elements_count), next_sequence(that.next_sequence) {
+        if (that.is_it_changed) {
+            changed_sequences = that.changed_sequences;
+            copy_changed();
+            changed_sequences.clear();
+        }
+    }
+
+    persistent_kvfifo(persistent_kvfifo &&that) noexcept
+        : elements(std::move(that.elements)), keys(std::move(that.keys)),
+          elements_count(exchange(that.elements_count, 0)),
+          next_sequence(that.next_sequence),
+          changed_sequences(std::move(that.changed_sequences)),
+          is_it_changed(exchange(that.is_it_changed, false)) {
+        that.changed_sequences.clear();
+    }
+
+    persistent_kvfifo &operator=(persistent_kvfifo other) noexcept {
+        swap(elements, other.elements);
+        swap(keys, other.keys);
+        swap(elements_count, other.elements_count);
+        swap(next_sequence, other.next_sequence);
+        swap(changed_sequences, other.changed_sequences);
+        swap(is_it_changed, other.is_it_changed);
+        return *this;
+    }
+
+    void push(K const &k, V const &v) {
+        uint64_t sequence = next_sequence;
+        auto new_elements = elements_treap::insert(elements, sequence, make_shared<KV>(k, v));
+        auto entry = keys_treap::find(keys.get(), k);
+        typename keys_treap::node_ptr new_keys;
+        if (entry == nullptr) {
+            key_entry new_entry{sequence_treap::insert(nullptr, sequence, nothing()), 1};
+            new_keys = keys_treap::insert(keys, k, new_entry);
+        } else {
+            key_entry new_entry{sequence_treap::insert(entry->value.sequences, sequence, nothing()),
+                                entry->value.count + 1};
+            new_keys = keys_treap::assign(keys, k, new_entry);
+        }
+        elements = std::move(new_elements);
+        keys = std::move(new_keys);
+        elements_count++;
+        next_sequence++;
+        changed();
+    }
+
+    void pop() {
+        if (elements_count == 0)
+            throw invalid_argument("Empty fifo");
+        auto front_node = elements_treap::minimum(elements.get());
+        K const &k = front_node->value->first;
+        erase(front_node->key, k, keys_treap::find(keys.get(), k)->value);
+    }
+
+    void pop(K const &k) {
+        key_entry const &entry = existing_entry(k);
+        erase(sequence_treap::minimum(entry.sequences.get())->key, k, entry);
+    }
+
+    void move_to_back(K const &k) {
+        key_entry const &entry = existing_entry(k);
+
+        //give elements new sequence numbers, keeping their order
+        auto new_elements = elements;
+        typename sequence_treap::node_ptr new_sequences;
+        uint64_t sequence = next_sequence;
+        for (uint64_t old_sequence : sequence_treap::keys(entry.sequences.get())) {
+            auto value = elements_treap::find(new_elements.get(), old_sequence)->value;
+            new_elements = elements_treap::insert(elements_treap::erase(new_elements, old_sequence),
+                                                  sequence, value);
+            new_sequences = sequence_treap::insert(new_sequences, sequence, nothing());
+            sequence++;
+        }
+        auto new_keys = keys_treap::assign(keys, k, key_entry{new_sequences, entry.count});
+
+        elements = std::move(new_elements);
+        keys = std::move(new_keys);
+        next_sequence = sequence;
+        changed();
+    }
+
+    std::pair<K const &, V &> front() {
+        if (elements_count == 0)
+            throw invalid_argument("Empty fifo");
+        return changeable(elements_treap::minimum(elements.get())->key);
+    }
+
+    std::pair<K const &, V const &> front() const {
+        if (elements_count == 0)
+            throw invalid_argument("Empty fifo");
+        return element(elements_treap::minimum(elements.get())->key);
+    }
+
+    std::pair<K const &, V &> back() {
+        if (elements_count == 0)
+            throw invalid_argument("Empty fifo");
+        return changeable(elements_treap::maximum(elements.get())->key);
+    }
+
+    std::pair<K const &, V const &> back() const {
+        if (elements_count == 0)
+            throw invalid_argument("Empty fifo");
+        return element(elements_treap::maximum(elements.get())->key);
+    }
+
+    std::pair<K const &, V &> first(K const &k) {
+        return changeable(sequence_treap::minimum(existing_entry(k).sequences.get())->key);
+    }
+
+    std::pair<K const &, V const &> first(K const &k) const {
+        return element(sequence_treap::minimum(existing_entry(k).sequences.get())->key);
+    }
+
+    std::pair<K const &, V &> last(K const &k) {
+        return changeable(sequence_treap::maximum(existing_entry(k).sequences.get())->key);
+    }
+
+    std::pair<K const &, V const &> last(K const &k) const {
+        return element(sequence_treap::maximum(existing_entry(k).sequences.get())->key);
+    }
+
+    size_t size() const noexcept {
+        return elements_count;
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    size_t count(K const &k) const {
+        auto entry = keys_treap::find(keys.get(), k);
+        if (entry == nullptr)
+            return 0;
+        else
+            return entry->value.count;
+    }
+
+    void clear() noexcept {
+        elements = nullptr;
+        keys = nullptr;
+        elements_count = 0;
+        changed();
+    }
+
+    // iterates over keys of the queue as it was when the iterator was made
+    class k_iterator {
+    private:
+        using node = typename keys_treap::node;
+
+        // keeps the version of keys alive
+        typename keys_treap::node_ptr root;
+
+        // nodes from the root to the current one, empty at the end
+        vector<node const *> path;
+
+        void go_left_from(node const *current) {
+            for (; current != nullptr; current = current->left.get())
+                path.push_back(current);
+        }
+
+        void go_right_from(node const *current) {
+            for (; current != nullptr; current = current->right.get())
+                path.push_back(current);
+        }
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = K;
+        using pointer = K *;
+        using reference = K &;
+
+        k_iterator(typename keys_treap::node_ptr their_root, bool at_begin) : root(std::move(their_root)) {
+            if (at_begin)
+                go_left_from(root.get());
+        }
+
+        k_iterator() = default;
+
+        //dereference operator for iterator returns key
+        const K &operator*() const { return path.back()->key; }
+
+        k_iterator &operator++() {
+            node const *current = path.back();
+            if (current->right != nullptr) {
+                go_left_from(current->right.get());
+            } else {
+                path.pop_back();
+                while (!path.empty() && path.back()->right.get() == current) {
+                    current = path.back();
+                    path.pop_back();
+                }
+            }
+            return *this;
+        }
+
+        k_iterator operator++(int) {
+            k_iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        k_iterator &operator--() {
+            if (path.empty()) {
+                go_right_from(root.get());
+                return *this;
+            }
+            node const *current = path.back();
+            if (current->left != nullptr) {
+                go_right_from(current->left.get());
+            } else {
+                path.pop_back();
+                while (path.back()->left.get() == current) {
+                    current = path.back();
+                    path.pop_back();
+                }
+            }
+            return *this;
+        }
+
+        k_iterator operator--(int) {
+            k_iterator tmp = *this;
+            --(*this);
+            return tmp;
+        }
+
+        bool operator==(const persistent_kvfifo<K, V>::k_iterator &that) const {
+            if (path.empty() || that.path.empty())
+                return path.empty() && that.path.empty() && root == that.root;
+            return path.back() == that.path.back();
+        }
+
+        bool operator!=(const persistent_kvfifo<K, V>::k_iterator &that) const {
+            return !(*this == that);
+        }
+    };
+
+    k_iterator k_begin() const {
+        return k_iterator(keys, true);
+    }
+
+    k_iterator k_end() const {
+        return k_iterator(keys, false);
+    }
+};
+
+#endif // PERSISTENT_KVFIFO_H
@@ -2,70 +2,250 @@
 #define MONEYBAG_H_
 
 #include <cstdint>
+#include <cstring>
 #include <ostream>
 #include <iostream>
 #include <compare>
+#include <stdexcept>
+#include <concepts>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <algorithm>
+#include <bit>
+#include <version>
+#ifdef __cpp_lib_format
+#include <format>
+#endif
 
 using namespace std;
 
 namespace {
     // Constant for 2^64 - 1
     const uint64_t MAX_VALUE = 18446744073709551615u;
+
+    // Signed type for intermediate results of lazy expressions
+    using wide_coin_t = __int128_t;
+
+    // Constant for 10^19, the biggest power of 10 fitting into uint64_t
+    constexpr uint64_t POW10_19 = 10000000000000000000u;
+
+    // Maximal number of decimal digits of uint64_t and of 128-bit values
+    constexpr size_t MAX_DIGITS_64 = 20;
+    constexpr size_t MAX_DIGITS_128 = 39;
+
+    // Table of pairs of digits "00", "01", ..., "99"
+    constexpr struct digit_pairs_t {
+        char digits[200];
+        constexpr digit_pairs_t() : digits() {
+            for (int i = 0; i < 100; i++) {
+                digits[2 * i] = (char)('0' + i / 10);
+                digits[2 * i + 1] = (char)('0' + i % 10);
+            }
+        }
+    } DIGIT_PAIRS;
+
+    // Writes decimal digits of number so that they end just before end,
+    // padding with zeros to at least min_digits digits.
+    // Returns pointer to the first written digit.
+    inline char* write_digits_backwards(char* end, uint64_t number,
+                                        size_t min_digits = 1) {
+        char* begin = end;
+        while (number >= 100) {
+            const uint64_t pair = number % 100;
+            number /= 100;
+            begin -= 2;
+            memcpy(begin, DIGIT_PAIRS.digits + 2 * pair, 2);
+        }
+        if (number >= 10) {
+            begin -= 2;
+            memcpy(begin, DIGIT_PAIRS.digits + 2 * number, 2);
+        } else {
+            *--begin = (char)('0' + number);
+        }
+        while ((size_t)(end - begin) < min_digits)
+            *--begin = '0';
+        return begin;
+    }
+
+    // Writes decimal representation of number into [first, last)
+    inline to_chars_result write_digits(char* first, char* last, uint64_t number) {
+        char buffer[MAX_DIGITS_64];
+        char* begin = write_digits_backwards(buffer + MAX_DIGITS_64, number);
+        const size_t length = buffer + MAX_DIGITS_64 - begin;
+        if ((size_t)(last - first) < length)
+            return {last, errc::value_too_large};
+        memcpy(first, begin, length);
+        return {first + length, errc()};
+    }
+
+    // Writes text into [first, last)
+    inline to_chars_result write_text(char* first, char* last, string_view text) {
+        if ((size_t)(last - first) < text.size())
+            return {last, errc::value_too_large};
+        memcpy(first, text.data(), text.size());
+        return {first + text.size(), errc()};
+    }
 }
 
-// Moneybag class 
+// Arithmetic policies, they decide what happens when result of operation
+// on coins does not fit into coin_number_t. Each operation stores its result
+// and returns whether it went out of range. Only policies with
+// reports_overflow set make Moneybag throw, for others checks are compiled out.
+
+// Throws out_of_range, overflow is detected with compiler intrinsics
+struct CheckedArithmetic {
+    using coin_number_t = uint64_t;
+    static constexpr bool reports_overflow = true;
+
+    static constexpr bool add(coin_number_t lhs, coin_number_t rhs,
+                              coin_number_t& result) {
+        return __builtin_add_overflow(lhs, rhs, &result);
+    }
+    static constexpr bool subtract(coin_number_t lhs, coin_number_t rhs,
+                                   coin_number_t& result) {
+        return __builtin_sub_overflow(lhs, rhs, &result);
+    }
+    static constexpr bool multiply(coin_number_t lhs, coin_number_t rhs,
+                                   coin_number_t& result) {
+        return __builtin_mul_overflow(lhs, rhs, &result);
+    }
+    // Narrows result of expression, results beyond 128 bits come as values
+    // of the same sign and the same lowest 64 bits
+    static constexpr bool narrow(wide_coin_t value, coin_number_t& result) {
+        result = (coin_number_t)value;
+        return value < 0 || value > (wide_coin_t)MAX_VALUE;
+    }
+};
+
+// Clamps results to [0, 2^64 - 1]
+struct SaturatingArithmetic {
+    using coin_number_t = uint64_t;
+    static constexpr bool reports_overflow = false;
+
+    static constexpr bool add(coin_number_t lhs, coin_number_t rhs,
+                              coin_number_t& result) {
+        if (__builtin_add_overflow(lhs, rhs, &result))
+            result = MAX_VALUE;
+        return false;
+    }
+    static constexpr bool subtract(coin_number_t lhs, coin_number_t rhs,
+                                   coin_number_t& result) {
+        if (__builtin_sub_overflow(lhs, rhs, &result))
+            result = 0;
+        return false;
+    }
+    static constexpr bool multiply(coin_number_t lhs, coin_number_t rhs,
+                                   coin_number_t& result) {
+        if (__builtin_mul_overflow(lhs, rhs, &result))
+            result = MAX_VALUE;
+        return false;
+    }
+    static constexpr bool narrow(wide_coin_t value, coin_number_t& result) {
+        if (value > (wide_coin_t)MAX_VALUE)
+            result = MAX_VALUE;
+        else if (value < 0)
+            result = 0;
+        else
+            result = (coin_number_t)value;
+        return false;
+    }
+};
+
+// Does not check anything, results are taken modulo 2^64
+struct WrappingArithmetic {
+    using coin_number_t = uint64_t;
+    static constexpr bool reports_overflow = false;
+
+    static constexpr bool add(coin_number_t lhs, coin_number_t rhs,
+                              coin_number_t& result) {
+        result = lhs + rhs;
+        return false;
+    }
+    static constexpr bool subtract(coin_number_t lhs, coin_number_t rhs,
+                                   coin_number_t& result) {
+        result = lhs - rhs;
+        return false;
+    }
+    static constexpr bool multiply(coin_number_t lhs, coin_number_t rhs,
+                                   coin_number_t& result) {
+        result = lhs * rhs;
+        return false;
+    }
+    static constexpr bool narrow(wide_coin_t value, coin_number_t& result) {
+        result = (coin_number_t)value;
+        return false;
+    }
+};
+
+// Moneybag class, parametrized by arithmetic policy
 
-class Moneybag { 
+template <typename ArithmeticPolicy = CheckedArithmetic>
+class BasicMoneybag { 
 
 public:    
     using coin_number_t = uint64_t; 
+    using policy_t = ArithmeticPolicy;
 
-    constexpr Moneybag(coin_number_t livre, coin_number_t solidus, coin_number_t denier):
+    constexpr BasicMoneybag(coin_number_t livre, coin_number_t solidus, coin_number_t denier):
     livre(livre), solidus(solidus), denier(denier){};
+    template <typename OtherPolicy>
+    constexpr explicit BasicMoneybag(const BasicMoneybag<OtherPolicy>& other):
+    livre(other.livre_number()), solidus(other.solidus_number()),
+    denier(other.denier_number()){}
     constexpr coin_number_t livre_number() const;
     constexpr coin_number_t solidus_number() const;
     constexpr coin_number_t denier_number() const;
 
-    inline friend ostream& operator<< (ostream& os, const Moneybag& moneybag);
+    constexpr bool operator== (const BasicMoneybag& other) const;
 
-    constexpr bool operator== (const Moneybag& other) const;
+    constexpr BasicMoneybag& operator+= (const BasicMoneybag& rhs);
+    constexpr BasicMoneybag& operator-= (const BasicMoneybag& rhs);
+    constexpr BasicMoneybag& operator*= (coin_number_t rhs);
 
-    constexpr  Moneybag& operator+= (const Moneybag& rhs);
-    constexpr Moneybag& operator-= (const Moneybag& rhs);
-    constexpr Moneybag& operator*= (coin_number_t rhs);
-    constexpr friend Moneybag operator*(Moneybag::coin_number_t lhs, 
-    					 const Moneybag& rhs);
+    constexpr BasicMoneybag operator+ (const BasicMoneybag& other) const;
+    constexpr BasicMoneybag operator- (const BasicMoneybag& other) const;
+    constexpr BasicMoneybag operator* (coin_number_t other) const;
 
-    constexpr Moneybag operator+ (const Moneybag& other) const;
-    constexpr Moneybag operator- (const Moneybag& other) const;
-    constexpr Moneybag operator* (coin_number_t other) const;
-
-    constexpr auto operator<=> (const Moneybag& other) const;
+    constexpr auto operator<=> (const BasicMoneybag& other) const;
     constexpr explicit operator bool() const {
         return livre > 0 || solidus > 0 || denier > 0;
     }
 
+    // Maximal length of text representation of Moneybag
+    static constexpr size_t max_text_length = 3 * MAX_DIGITS_64 + 31;
+
 private:
     coin_number_t livre;
     coin_number_t solidus;
     coin_number_t denier; 
 };
 
+// Moneybag with checked arithmetic is the default one
+using Moneybag = BasicMoneybag<CheckedArithmetic>;
+using SaturatingMoneybag = BasicMoneybag<SaturatingArithmetic>;
+using WrappingMoneybag = BasicMoneybag<WrappingArithmetic>;
+
 // Value class
 
 class Value {
 public:
     using value_t = __uint128_t;
 
-    Value() : denierV(0) {};
-    explicit Value(Moneybag::coin_number_t deniers) : denierV(deniers) {};
-    explicit Value(const Moneybag& moneybag) {
+    constexpr Value() : denierV(0) {};
+    constexpr explicit Value(Moneybag::coin_number_t deniers) : denierV(deniers) {};
+    template <typename Policy>
+    constexpr explicit Value(const BasicMoneybag<Policy>& moneybag) {
   	    value_t result = 0;
      	result += (((value_t(20) * moneybag.livre_number()) + 
                   moneybag.solidus_number()) * value_t(12)) + moneybag.denier_number();
     	this->denierV = result;
     }
 
+    // Value of given number of deniers, which may not fit into 64 bits
+    static constexpr Value from_deniers(value_t deniers);
+
     constexpr value_t get_value() const;
     constexpr bool operator==(const Value &other) const;
     constexpr bool operator==(uint64_t number) const;
@@ -74,124 +254,162 @@ public:
 
     inline explicit operator std::string() const;
 
+    // Maximal length of decimal representation of Value
+    static constexpr size_t max_digits = MAX_DIGITS_128;
+
 private:
     value_t denierV;
 };
 
 // Moneybag implementation
 
-constexpr Moneybag::coin_number_t Moneybag::livre_number() const {
+template <typename Policy>
+constexpr typename BasicMoneybag<Policy>::coin_number_t
+BasicMoneybag<Policy>::livre_number() const {
         return this->livre;
 }
 
-constexpr Moneybag::coin_number_t Moneybag::solidus_number() const {
+template <typename Policy>
+constexpr typename BasicMoneybag<Policy>::coin_number_t
+BasicMoneybag<Policy>::solidus_number() const {
         return this->solidus;
 }
     
-constexpr Moneybag::coin_number_t Moneybag::denier_number() const {
+template <typename Policy>
+constexpr typename BasicMoneybag<Policy>::coin_number_t
+BasicMoneybag<Policy>::denier_number() const {
         return this->denier;
 }
 
-inline ostream& operator<< (ostream& os, const Moneybag& moneybag) {
-    string result = "(";
-    result += to_string(moneybag.livre_number());
-    result += " livr";
-    if (moneybag.livre_number() != 1)
-        result += "es";
-    result += ", " + to_string(moneybag.solidus_number());
-    result += " solidus";
-    if (moneybag.solidus_number() != 1)
-        result += "es";
-    result += ", " + to_string(moneybag.denier_number());
-    result += " denier";
-    if (moneybag.denier_number() != 1)
-        result += "s";
-    result += ")";
-    os << result;
-    return os;
+// Writes text representation of moneybag, for example
+// "(1 livr, 2 soliduses, 0 deniers)", into [first, last) without allocating
+template <typename Policy>
+inline to_chars_result to_chars(char* first, char* last,
+                                const BasicMoneybag<Policy>& moneybag) {
+    const uint64_t livre = moneybag.livre_number();
+    const uint64_t solidus = moneybag.solidus_number();
+    const uint64_t denier = moneybag.denier_number();
+
+    to_chars_result result = write_text(first, last, "(");
+    if (result.ec == errc())
+        result = write_digits(result.ptr, last, livre);
+    if (result.ec == errc())
+        result = write_text(result.ptr, last, livre != 1 ? " livres, " : " livr, ");
+    if (result.ec == errc())
+        result = write_digits(result.ptr, last, solidus);
+    if (result.ec == errc())
+        result = write_text(result.ptr, last,
+                            solidus != 1 ? " soliduses, " : " solidus, ");
+    if (result.ec == errc())
+        result = write_digits(result.ptr, last, denier);
+    if (result.ec == errc())
+        result = write_text(result.ptr, last, denier != 1 ? " deniers)" : " denier)");
+    return result;
 }
 
+template <typename Policy>
+inline ostream& operator<< (ostream& os, const BasicMoneybag<Policy>& moneybag) {
+    char buffer[Moneybag::max_text_length];
+    const to_chars_result result =
+        to_chars(buffer, buffer + Moneybag::max_text_length, moneybag);
+    os << string_view(buffer, result.ptr - buffer);
+    return os;
+}
 
-constexpr bool Moneybag::operator==(const Moneybag& other) const {
+template <typename Policy>
+constexpr bool BasicMoneybag<Policy>::operator==(const BasicMoneybag& other) const {
     return (this->livre == other.livre && this->solidus == other.solidus
             && this->denier == other.denier);
 }
 
-constexpr Moneybag & Moneybag::operator+=(const Moneybag &rhs) {
-    if (MAX_VALUE - livre < rhs.livre)
-        throw out_of_range("Cannot add livres, it exceeds max possible value");
-    if (MAX_VALUE - solidus < rhs.solidus)
-        throw out_of_range("Cannot add soliduses, it exceeds max possible value");
-    if (MAX_VALUE - denier < rhs.denier)
-        throw out_of_range("Cannot add deniers, it exceeds max possible value");    
-    livre += rhs.livre;
-    solidus += rhs.solidus;
-    denier += rhs.denier;
+template <typename Policy>
+constexpr BasicMoneybag<Policy>& BasicMoneybag<Policy>::operator+=(const BasicMoneybag &rhs) {
+    coin_number_t new_livre = 0, new_solidus = 0, new_denier = 0;
+    const bool livre_overflow = Policy::add(livre, rhs.livre, new_livre);
+    const bool solidus_overflow = Policy::add(solidus, rhs.solidus, new_solidus);
+    const bool denier_overflow = Policy::add(denier, rhs.denier, new_denier);
+    if constexpr (Policy::reports_overflow) {
+        if (livre_overflow)
+            throw out_of_range("Cannot add livres, it exceeds max possible value");
+        if (solidus_overflow)
+            throw out_of_range("Cannot add soliduses, it exceeds max possible value");
+        if (denier_overflow)
+            throw out_of_range("Cannot add deniers, it exceeds max possible value");
+    }
+    livre = new_livre;
+    solidus = new_solidus;
+    denier = new_denier;
     return *this;
 }
 
-constexpr Moneybag & Moneybag::operator-=(const Moneybag &rhs) {
-    if (livre < rhs.livre_number()) {
-        throw out_of_range("Cannot substract livres, it goes below 0");
-    } 
-    if (solidus < rhs.solidus_number()) {
-        throw out_of_range("Cannot subtract soliduses, it goes below 0");
-    } 
-    if (denier < rhs.denier_number()) {
-        throw out_of_range("Cannot subtract deniers, it goes below 0"); 
-    } 
-    livre -= rhs.livre;
-    solidus -= rhs.solidus;
-    denier -= rhs.denier;
+template <typename Policy>
+constexpr BasicMoneybag<Policy>& BasicMoneybag<Policy>::operator-=(const BasicMoneybag &rhs) {
+    coin_number_t new_livre = 0, new_solidus = 0, new_denier = 0;
+    const bool livre_overflow = Policy::subtract(livre, rhs.livre, new_livre);
+    const bool solidus_overflow = Policy::subtract(solidus, rhs.solidus, new_solidus);
+    const bool denier_overflow = Policy::subtract(denier, rhs.denier, new_denier);
+    if constexpr (Policy::reports_overflow) {
+        if (livre_overflow)
+            throw out_of_range("Cannot substract livres, it goes below 0");
+        if (solidus_overflow)
+            throw out_of_range("Cannot subtract soliduses, it goes below 0");
+        if (denier_overflow)
+            throw out_of_range("Cannot subtract deniers, it goes below 0");
+    }
+    livre = new_livre;
+    solidus = new_solidus;
+    denier = new_denier;
     return *this;
 }
 
-constexpr Moneybag & Moneybag::operator*=(Moneybag::coin_number_t scalar) {	
-    if (scalar == 0) {
-        livre = 0;
-        solidus = 0;
-        denier = 0;
-        return *this;
+template <typename Policy>
+constexpr BasicMoneybag<Policy>& BasicMoneybag<Policy>::operator*=(coin_number_t scalar) {	
+    coin_number_t new_livre = 0, new_solidus = 0, new_denier = 0;
+    const bool livre_overflow = Policy::multiply(livre, scalar, new_livre);
+    const bool solidus_overflow = Policy::multiply(solidus, scalar, new_solidus);
+    const bool denier_overflow = Policy::multiply(denier, scalar, new_denier);
+    if constexpr (Policy::reports_overflow) {
+        if (livre_overflow)
+            throw out_of_range("Cannot multiply scalar by livres, it exceeds max value");
+        if (solidus_overflow)
+            throw out_of_range("Cannot multiply scalar by soliduses, it exceeds max value");
+        if (denier_overflow)
+            throw out_of_range("Cannot multiply scalar by deniers, it exceeds max value");
     }
-
-    if (MAX_VALUE / scalar < livre) {
-        throw out_of_range("Cannot multiply scalar by livres, it exceeds max value");
-    } 
-    if (MAX_VALUE / scalar < solidus) {
-        throw out_of_range("Cannot multiply scalar by soliduses, it exceeds max value");
-    } 
-    if (MAX_VALUE / scalar < denier) {
-        throw out_of_range("Cannot multiply scalar by deniers, it exceeds max value");    
-    } 
-
-    livre *= scalar;
-    solidus *= scalar;
-    denier *= scalar;
+    livre = new_livre;
+    solidus = new_solidus;
+    denier = new_denier;
     return *this;
 }
 
-constexpr Moneybag Moneybag::operator+(const Moneybag &rhs) const {
-    Moneybag tmp(*this);
+template <typename Policy>
+constexpr BasicMoneybag<Policy> BasicMoneybag<Policy>::operator+(const BasicMoneybag &rhs) const {
+    BasicMoneybag tmp(*this);
     return tmp += rhs;
 }
 
-constexpr Moneybag Moneybag::operator-(const Moneybag &rhs) const {
-    Moneybag tmp(*this);
+template <typename Policy>
+constexpr BasicMoneybag<Policy> BasicMoneybag<Policy>::operator-(const BasicMoneybag &rhs) const {
+    BasicMoneybag tmp(*this);
     return tmp -= rhs;
 }
 
-constexpr Moneybag Moneybag::operator*(const Moneybag::coin_number_t scalar) const {
-    Moneybag tmp(*this);
+template <typename Policy>
+constexpr BasicMoneybag<Policy> BasicMoneybag<Policy>::operator*(const coin_number_t scalar) const {
+    BasicMoneybag tmp(*this);
     return tmp *= scalar;
 }
 
-constexpr Moneybag operator*(Moneybag::coin_number_t lhs, const Moneybag &rhs) {
-    Moneybag tmp = rhs;
+template <typename Policy>
+constexpr BasicMoneybag<Policy> operator*(typename BasicMoneybag<Policy>::coin_number_t lhs,
+                                          const BasicMoneybag<Policy> &rhs) {
+    BasicMoneybag<Policy> tmp = rhs;
     tmp *= lhs;
     return tmp;
 }
 
-constexpr auto Moneybag::operator<=>(const Moneybag &rhs) const {
+template <typename Policy>
+constexpr auto BasicMoneybag<Policy>::operator<=>(const BasicMoneybag &rhs) const {
     if (livre == rhs.livre && solidus == rhs.solidus && denier == rhs.denier) {
         return partial_ordering::equivalent;
     }
@@ -204,24 +422,373 @@ constexpr auto Moneybag::operator<=>(const Moneybag &rhs) const {
     return partial_ordering::unordered;
 }
 
+// Lazy Moneybag expressions. lazy(moneybag) starts an expression, then sums,
+// differences and products with scalars build a tree of small objects instead
+// of temporary Moneybags. The tree is evaluated in one pass when converted to
+// Moneybag: intermediates are signed 128-bit numbers, so they may temporarily
+// go below 0 or above 2^64 - 1, and the range is checked once at the end
+// according to the arithmetic policy of the result.
+// Before evaluation every node bounds the number of bits of its coins from
+// the shape of the tree and its scalars. If the bound fits into 128 bits,
+// which is so unless scalars are huge, no intermediate can overflow and the
+// tree is evaluated with two words; otherwise it is evaluated exactly with as
+// many words as the type of the tree may need, so the sign is never lost.
+// Each kind of coin is evaluated separately, so that the compiler keeps
+// intermediates in registers.
+
+// Kinds of coins, index of coin in expression nodes
+enum class Coin { livre, solidus, denier };
+
+// Signed 128-bit intermediate of the unchecked evaluation, as two 64-bit
+// words, which GCC handles much better than __int128 in registers.
+// Words wrap around, bound on bits makes the whole number correct.
+struct WideCoin {
+    uint64_t low;
+    uint64_t high;
+
+    constexpr wide_coin_t value() const {
+        return (wide_coin_t)(int64_t)high * ((wide_coin_t)1 << 64) + low;
+    }
+};
+
+// Signed intermediate of the exact evaluation, Words 64-bit words in two's
+// complement, least significant first. Words wrap around, there are enough
+// of them for every value the tree may compute.
+template <size_t Words>
+struct ExactCoin {
+    static_assert(Words >= 2, "coins take 64 bits and a sign");
+
+    uint64_t words[Words];
+
+    constexpr explicit ExactCoin(uint64_t coin) : words{coin} {}
+
+    constexpr ExactCoin& operator+=(const ExactCoin& rhs) {
+        bool carry = false;
+        for (size_t i = 0; i < Words; i++)
+            carry = __builtin_add_overflow(words[i], rhs.words[i], &words[i])
+                    | __builtin_add_overflow(words[i], (uint64_t)carry, &words[i]);
+        return *this;
+    }
+
+    constexpr ExactCoin& operator-=(const ExactCoin& rhs) {
+        bool borrow = false;
+        for (size_t i = 0; i < Words; i++)
+            borrow = __builtin_sub_overflow(words[i], rhs.words[i], &words[i])
+                     | __builtin_sub_overflow(words[i], (uint64_t)borrow, &words[i]);
+        return *this;
+    }
+
+    constexpr ExactCoin& operator*=(uint64_t scalar) {
+        uint64_t carry = 0;
+        for (size_t i = 0; i < Words; i++) {
+            const __uint128_t product = (__uint128_t)words[i] * scalar + carry;
+            words[i] = (uint64_t)product;
+            carry = (uint64_t)(product >> 64);
+        }
+        return *this;
+    }
+
+    // The value if it fits into 128 bits, otherwise a value of the same sign
+    // and the same lowest 64 bits
+    constexpr wide_coin_t value() const {
+        const bool negative = (int64_t)words[Words - 1] < 0;
+        bool fits = ((int64_t)words[1] < 0) == negative;
+        for (size_t i = 2; i < Words; i++)
+            fits = fits && words[i] == (negative ? MAX_VALUE : 0);
+        const uint64_t high = fits ? words[1] : negative ? (uint64_t)INT64_MIN : (uint64_t)INT64_MAX;
+        return WideCoin{words[0], high}.value();
+    }
+};
+
+// Base of all expression types
+struct MoneybagExpressionTag {};
+
+template <typename Expression>
+concept MoneybagExpression = derived_from<Expression, MoneybagExpressionTag>;
+
+template <typename Derived>
+class MoneybagExpressionBase : public MoneybagExpressionTag {
+public:
+    template <typename Policy = CheckedArithmetic>
+    constexpr BasicMoneybag<Policy> evaluate() const {
+        const Derived& expression = static_cast<const Derived&>(*this);
+        if (expression.bits() < 128) [[likely]] {
+            const WideCoin livre = expression.wide(Coin::livre);
+            const WideCoin solidus = expression.wide(Coin::solidus);
+            const WideCoin denier = expression.wide(Coin::denier);
+            // coins in [0, 2^64 - 1] are the same for every policy
+            if ((livre.high | solidus.high | denier.high) == 0) [[likely]]
+                return BasicMoneybag<Policy>(livre.low, solidus.low, denier.low);
+            return narrow<Policy>(livre.value(), solidus.value(), denier.value());
+        }
+        return exact_evaluate<Policy>(expression);
+    }
+
+    template <typename Policy>
+    constexpr operator BasicMoneybag<Policy>() const {
+        return evaluate<Policy>();
+    }
+
+private:
+    // Evaluates with as many words as the type of the tree may need, rare
+    // cases are kept out of evaluate(), so that it is small enough to be inlined
+    template <typename Policy>
+    [[gnu::cold, gnu::noinline]]
+    static constexpr BasicMoneybag<Policy> exact_evaluate(const Derived& expression) {
+        constexpr size_t WORDS = Derived::max_bits() / 64 + 1;
+        return narrow<Policy>(expression.template exact<WORDS>(Coin::livre).value(),
+                              expression.template exact<WORDS>(Coin::solidus).value(),
+                              expression.template exact<WORDS>(Coin::denier).value());
+    }
+
+    // Applies policy to coins out of range
+    template <typename Policy>
+    [[gnu::cold, gnu::noinline]]
+    static constexpr BasicMoneybag<Policy> narrow(wide_coin_t wide_livre, wide_coin_t wide_solidus,
+                                                  wide_coin_t wide_denier) {
+        using coin_number_t = typename BasicMoneybag<Policy>::coin_number_t;
+        coin_number_t livre = 0, solidus = 0, denier = 0;
+        const bool livre_overflow = Policy::narrow(wide_livre, livre);
+        const bool solidus_overflow = Policy::narrow(wide_solidus, solidus);
+        const bool denier_overflow = Policy::narrow(wide_denier, denier);
+        if constexpr (Policy::reports_overflow) {
+            if (livre_overflow)
+                throw out_of_range("Cannot evaluate livres, it goes out of range");
+            if (solidus_overflow)
+                throw out_of_range("Cannot evaluate soliduses, it goes out of range");
+            if (denier_overflow)
+                throw out_of_range("Cannot evaluate deniers, it goes out of range");
+        }
+        return BasicMoneybag<Policy>(livre, solidus, denier);
+    }
+};
+
+// Leaf of expression, holds copy of coins
+class MoneybagTerm : public MoneybagExpressionBase<MoneybagTerm> {
+public:
+    template <typename Policy>
+    constexpr explicit MoneybagTerm(const BasicMoneybag<Policy>& moneybag) :
+    coins{moneybag.livre_number(), moneybag.solidus_number(), moneybag.denier_number()} {}
+
+    // Coins of this node and of all nodes below are less than 2^bits()
+    // in absolute value
+    constexpr int bits() const {
+        return 64;
+    }
+
+    // Bound of bits() for any scalars
+    static constexpr int max_bits() {
+        return 64;
+    }
+
+    constexpr WideCoin wide(Coin coin) const {
+        return {coins[static_cast<int>(coin)], 0};
+    }
+
+    template <size_t Words>
+    constexpr ExactCoin<Words> exact(Coin coin) const {
+        return ExactCoin<Words>(coins[static_cast<int>(coin)]);
+    }
+
+private:
+    uint64_t coins[3];
+};
+
+template <MoneybagExpression Lhs, MoneybagExpression Rhs>
+class MoneybagSum : public MoneybagExpressionBase<MoneybagSum<Lhs, Rhs>> {
+public:
+    constexpr MoneybagSum(const Lhs& lhs, const Rhs& rhs) : lhs(lhs), rhs(rhs) {}
+
+    constexpr int bits() const {
+        return max(lhs.bits(), rhs.bits()) + 1;
+    }
+
+    static constexpr int max_bits() {
+        return max(Lhs::max_bits(), Rhs::max_bits()) + 1;
+    }
+
+    constexpr WideCoin wide(Coin coin) const {
+        const WideCoin left = lhs.wide(coin);
+        const WideCoin right = rhs.wide(coin);
+        WideCoin result{0, 0};
+        const bool carry = __builtin_add_overflow(left.low, right.low, &result.low);
+        result.high = left.high + right.high + carry;
+        return result;
+    }
+
+    template <size_t Words>
+    constexpr ExactCoin<Words> exact(Coin coin) const {
+        ExactCoin<Words> result = lhs.template exact<Words>(coin);
+        result += rhs.template exact<Words>(coin);
+        return result;
+    }
+
+private:
+    Lhs lhs;
+    Rhs rhs;
+};
+
+template <MoneybagExpression Lhs, MoneybagExpression Rhs>
+class MoneybagDifference : public MoneybagExpressionBase<MoneybagDifference<Lhs, Rhs>> {
+public:
+    constexpr MoneybagDifference(const Lhs& lhs, const Rhs& rhs) : lhs(lhs), rhs(rhs) {}
+
+    constexpr int bits() const {
+        return max(lhs.bits(), rhs.bits()) + 1;
+    }
+
+    static constexpr int max_bits() {
+        return max(Lhs::max_bits(), Rhs::max_bits()) + 1;
+    }
+
+    constexpr WideCoin wide(Coin coin) const {
+        const WideCoin left = lhs.wide(coin);
+        const WideCoin right = rhs.wide(coin);
+        WideCoin result{0, 0};
+        const bool borrow = __builtin_sub_overflow(left.low, right.low, &result.low);
+        result.high = left.high - right.high - borrow;
+        return result;
+    }
+
+    template <size_t Words>
+    constexpr ExactCoin<Words> exact(Coin coin) const {
+        ExactCoin<Words> result = lhs.template exact<Words>(coin);
+        result -= rhs.template exact<Words>(coin);
+        return result;
+    }
+
+private:
+    Lhs lhs;
+    Rhs rhs;
+};
+
+template <MoneybagExpression Operand>
+class MoneybagProduct : public MoneybagExpressionBase<MoneybagProduct<Operand>> {
+public:
+    constexpr MoneybagProduct(const Operand& operand, uint64_t scalar) :
+    operand(operand), scalar(scalar) {}
+
+    constexpr int bits() const {
+        return operand.bits() + bit_width(scalar);
+    }
+
+    static constexpr int max_bits() {
+        return Operand::max_bits() + 64;
+    }
+
+    constexpr WideCoin wide(Coin coin) const {
+        const WideCoin coins = operand.wide(coin);
+        const __uint128_t low = (__uint128_t)coins.low * scalar;
+        return {(uint64_t)low, coins.high * scalar + (uint64_t)(low >> 64)};
+    }
+
+    template <size_t Words>
+    constexpr ExactCoin<Words> exact(Coin coin) const {
+        ExactCoin<Words> result = operand.template exact<Words>(coin);
+        result *= scalar;
+        return result;
+    }
+
+private:
+    Operand operand;
+    uint64_t scalar;
+};
+
+// Starts lazy expression
+template <typename Policy>
+constexpr MoneybagTerm lazy(const BasicMoneybag<Policy>& moneybag) {
+    return MoneybagTerm(moneybag);
+}
+
+template <MoneybagExpression Lhs, MoneybagExpression Rhs>
+constexpr MoneybagSum<Lhs, Rhs> operator+(const Lhs& lhs, const Rhs& rhs) {
+    return MoneybagSum<Lhs, Rhs>(lhs, rhs);
+}
+
+template <MoneybagExpression Lhs, typename Policy>
+constexpr MoneybagSum<Lhs, MoneybagTerm> operator+(const Lhs& lhs,
+                                                   const BasicMoneybag<Policy>& rhs) {
+    return MoneybagSum<Lhs, MoneybagTerm>(lhs, MoneybagTerm(rhs));
+}
+
+template <typename Policy, MoneybagExpression Rhs>
+constexpr MoneybagSum<MoneybagTerm, Rhs> operator+(const BasicMoneybag<Policy>& lhs,
+                                                   const Rhs& rhs) {
+    return MoneybagSum<MoneybagTerm, Rhs>(MoneybagTerm(lhs), rhs);
+}
+
+template <MoneybagExpression Lhs, MoneybagExpression Rhs>
+constexpr MoneybagDifference<Lhs, Rhs> operator-(const Lhs& lhs, const Rhs& rhs) {
+    return MoneybagDifference<Lhs, Rhs>(lhs, rhs);
+}
+
+template <MoneybagExpression Lhs, typename Policy>
+constexpr MoneybagDifference<Lhs, MoneybagTerm> operator-(const Lhs& lhs,
+                                                          const BasicMoneybag<Policy>& rhs) {
+    return MoneybagDifference<Lhs, MoneybagTerm>(lhs, MoneybagTerm(rhs));
+}
+
+template <typename Policy, MoneybagExpression Rhs>
+constexpr MoneybagDifference<MoneybagTerm, Rhs> operator-(const BasicMoneybag<Policy>& lhs,
+                                                          const Rhs& rhs) {
+    return MoneybagDifference<MoneybagTerm, Rhs>(MoneybagTerm(lhs), rhs);
+}
+
+template <MoneybagExpression Operand>
+constexpr MoneybagProduct<Operand> operator*(const Operand& operand, uint64_t scalar) {
+    return MoneybagProduct<Operand>(operand, scalar);
+}
+
+template <MoneybagExpression Operand>
+constexpr MoneybagProduct<Operand> operator*(uint64_t scalar, const Operand& operand) {
+    return MoneybagProduct<Operand>(operand, scalar);
+}
+
 // Value implementation
 
+constexpr Value Value::from_deniers(value_t deniers) {
+    Value result;
+    result.denierV = deniers;
+    return result;
+}
+
 constexpr Value::value_t Value::get_value() const {
     return this->denierV;
 }
 
-inline Value::operator string() const {
-    string result;
-    Value::value_t help = this->denierV;
-    if (help == 0)
-    	return "0";
-
-    while(help) {
-        result += (char)('0' + (help % 10));
-        help /= 10;
+// Writes decimal representation of value into [first, last) without
+// allocating, like std::to_chars. The number is split into chunks of 19 digits
+// so that only two 128-bit divisions are needed, chunks are written using
+// 64-bit arithmetic.
+inline to_chars_result to_chars(char* first, char* last, const Value& value) {
+    Value::value_t number = value.get_value();
+    if (number <= MAX_VALUE)
+        return write_digits(first, last, (uint64_t)number);
+
+    char buffer[MAX_DIGITS_128];
+    char* end = buffer + MAX_DIGITS_128;
+    const uint64_t low = (uint64_t)(number % POW10_19);
+    number /= POW10_19;
+    char* begin = write_digits_backwards(end, low, 19);
+    if (number <= MAX_VALUE) {
+        begin = write_digits_backwards(begin, (uint64_t)number);
+    } else {
+        const uint64_t middle = (uint64_t)(number % POW10_19);
+        begin = write_digits_backwards(begin, middle, 19);
+        begin = write_digits_backwards(begin, (uint64_t)(number / POW10_19));
     }
-    reverse(result.begin(), result.end());
-    return result;
+
+    const size_t length = end - begin;
+    if ((size_t)(last - first) < length)
+        return {last, errc::value_too_large};
+    memcpy(first, begin, length);
+    return {first + length, errc()};
+}
+
+inline Value::operator string() const {
+    char buffer[Value::max_digits];
+    const to_chars_result result = to_chars(buffer, buffer + Value::max_digits, *this);
+    return string(buffer, result.ptr);
 }
 
 constexpr bool Value::operator==(const Value &other) const{
@@ -258,6 +825,34 @@ constexpr auto Value::operator<=>(const uint64_t number) const{
     return partial_ordering::unordered;
 }
 
+// Formatting with std::format, accepts the same options as strings
+
+#ifdef __cpp_lib_format
+template <typename Policy>
+struct std::formatter<BasicMoneybag<Policy>> : std::formatter<std::string_view> {
+    template <typename FormatContext>
+    auto format(const BasicMoneybag<Policy>& moneybag, FormatContext& context) const {
+        char buffer[Moneybag::max_text_length];
+        const to_chars_result result =
+            to_chars(buffer, buffer + Moneybag::max_text_length, moneybag);
+        return std::formatter<std::string_view>::format(
+            std::string_view(buffer, result.ptr - buffer), context);
+    }
+};
+#endif
+
+// Hashing of Value
+
+template <>
+struct std::hash<Value> {
+    size_t operator()(const Value& value) const noexcept {
+        const Value::value_t deniers = value.get_value();
+        const uint64_t low = (uint64_t)deniers;
+        const uint64_t high = (uint64_t)(deniers >> 64);
+        return std::hash<uint64_t>()(low ^ (high * 0x9e3779b97f4a7c15u));
+    }
+};
+
 // Objects representing single coins
 
 const Moneybag Livre = Moneybag(1, 0, 0);
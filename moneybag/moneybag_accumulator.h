@@ -0,0 +1,153 @@
+#ifndef MONEYBAG_ACCUMULATOR_H_
+#define MONEYBAG_ACCUMULATOR_H_
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#include "moneybag.h"
+
+// Sum of Moneybags updated concurrently from many threads.
+// Every thread writes only to its own shard, so add() takes no locks and
+// performs no read-modify-write on shared cache lines. Each shard is guarded
+// by a sequence counter with a single writer, readers retry while a write is
+// in progress, so every add() is seen by a snapshot completely or not at all.
+// The accumulator must outlive all threads adding to it.
+
+class MoneybagAccumulator {
+public:
+    MoneybagAccumulator() : id(next_id.fetch_add(1, memory_order_relaxed)) {}
+
+    MoneybagAccumulator(const MoneybagAccumulator&) = delete;
+    MoneybagAccumulator& operator=(const MoneybagAccumulator&) = delete;
+
+    ~MoneybagAccumulator() {
+        Shard* shard = shards.load(memory_order_acquire);
+        while (shard != nullptr) {
+            Shard* next = shard->next;
+            delete shard;
+            shard = next;
+        }
+    }
+
+    // Adds moneybag to the sum, throws out_of_range if coins added by this
+    // thread exceed max possible value, the sum does not change then
+    template <typename Policy>
+    void add(const BasicMoneybag<Policy>& moneybag) {
+        Shard& shard = shard_of_this_thread();
+        const uint64_t livre = shard.livre.load(memory_order_relaxed);
+        const uint64_t solidus = shard.solidus.load(memory_order_relaxed);
+        const uint64_t denier = shard.denier.load(memory_order_relaxed);
+        uint64_t new_livre = 0, new_solidus = 0, new_denier = 0;
+        if (__builtin_add_overflow(livre, moneybag.livre_number(), &new_livre))
+            throw out_of_range("Cannot add livres, it exceeds max possible value");
+        if (__builtin_add_overflow(solidus, moneybag.solidus_number(), &new_solidus))
+            throw out_of_range("Cannot add soliduses, it exceeds max possible value");
+        if (__builtin_add_overflow(denier, moneybag.denier_number(), &new_denier))
+            throw out_of_range("Cannot add deniers, it exceeds max possible value");
+
+        const uint64_t sequence = shard.sequence.load(memory_order_relaxed);
+        shard.sequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        shard.livre.store(new_livre, memory_order_relaxed);
+        shard.solidus.store(new_solidus, memory_order_relaxed);
+        shard.denier.store(new_denier, memory_order_relaxed);
+        shard.sequence.store(sequence + 2, memory_order_release);
+    }
+
+    // Snapshot of the sum
+    Value value() const {
+        Value::value_t result = 0;
+        for_each_snapshot([&](uint64_t livre, uint64_t solidus, uint64_t denier) {
+            result += ((Value::value_t(20) * livre) + solidus) * Value::value_t(12)
+                      + denier;
+        });
+        return Value::from_deniers(result);
+    }
+
+    // Snapshot of the sum as Moneybag, throws out_of_range if it does not fit
+    Moneybag moneybag() const {
+        Moneybag result(0, 0, 0);
+        for_each_snapshot([&](uint64_t livre, uint64_t solidus, uint64_t denier) {
+            result += Moneybag(livre, solidus, denier);
+        });
+        return result;
+    }
+
+private:
+    // Counters of one thread, aligned to avoid false sharing
+    struct alignas(64) Shard {
+        atomic<uint64_t> sequence{0};
+        atomic<uint64_t> livre{0};
+        atomic<uint64_t> solidus{0};
+        atomic<uint64_t> denier{0};
+        // Number of the thread writing to the shard
+        uint64_t owner = 0;
+        Shard* next = nullptr;
+    };
+
+    // Entry of thread local cache of shards
+    struct CachedShard {
+        uint64_t id = UINT64_MAX;
+        Shard* shard = nullptr;
+    };
+
+    // Number of accumulators each thread remembers its shards of
+    static constexpr size_t CACHE_SIZE = 8;
+
+    inline static atomic<uint64_t> next_id{0};
+
+    inline static atomic<uint64_t> next_thread{0};
+
+    // Identifies accumulator in thread local caches, never reused, so entries
+    // left by destroyed accumulators are never matched
+    const uint64_t id;
+
+    // List of shards, new shards are pushed at the front
+    atomic<Shard*> shards{nullptr};
+
+    // Thread local cache is direct mapped, so it stays small however many
+    // accumulators a thread uses; on a miss shard is looked up in the list
+    Shard& shard_of_this_thread() {
+        thread_local const uint64_t this_thread = next_thread.fetch_add(1, memory_order_relaxed);
+        thread_local CachedShard cache[CACHE_SIZE];
+        CachedShard& cached = cache[id % CACHE_SIZE];
+        if (cached.id == id)
+            return *cached.shard;
+
+        Shard* shard = shards.load(memory_order_acquire);
+        while (shard != nullptr && shard->owner != this_thread)
+            shard = shard->next;
+        if (shard == nullptr) {
+            shard = new Shard();
+            shard->owner = this_thread;
+            shard->next = shards.load(memory_order_relaxed);
+            while (!shards.compare_exchange_weak(shard->next, shard,
+                                                 memory_order_release,
+                                                 memory_order_relaxed)) {}
+        }
+        cached = {id, shard};
+        return *shard;
+    }
+
+    // Calls function with consistent counters of each shard
+    template <typename Function>
+    void for_each_snapshot(Function function) const {
+        for (const Shard* shard = shards.load(memory_order_acquire);
+             shard != nullptr; shard = shard->next) {
+            uint64_t livre, solidus, denier, before, after;
+            do {
+                before = shard->sequence.load(memory_order_acquire);
+                livre = shard->livre.load(memory_order_relaxed);
+                solidus = shard->solidus.load(memory_order_relaxed);
+                denier = shard->denier.load(memory_order_relaxed);
+                atomic_thread_fence(memory_order_acquire);
+                after = shard->sequence.load(memory_order_relaxed);
+            } while (before != after || (before & 1) != 0);
+            function(livre, solidus, denier);
+        }
+    }
+};
+
+#endif // MONEYBAG_ACCUMULATOR_H_
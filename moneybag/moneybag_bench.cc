@@ -0,0 +1,222 @@
+// Microbenchmarks of Moneybag and Value operators.
+// Build and run with:
+//     g++ -std=c++20 -O2 moneybag_bench.cc -o moneybag_bench
+//     ./moneybag_bench [repetitions]
+// Each benchmark prints time and number of heap allocations per operation.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "moneybag.h"
+
+using namespace std;
+
+namespace {
+
+// Number of heap allocations made so far
+size_t allocations = 0;
+
+// Number of operands generated for each benchmark
+const size_t OPERANDS = 1 << 14;
+
+// Default number of passes over operands
+const size_t REPETITIONS = 200;
+
+// Prevents compiler from optimizing away computed value
+template <typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "m"(value) : "memory");
+}
+
+// Stream buffer which discards everything, so that only formatting is measured
+class null_buffer : public streambuf {
+protected:
+    int_type overflow(int_type c) override {
+        return c;
+    }
+    streamsize xsputn(const char *, streamsize count) override {
+        return count;
+    }
+};
+
+// Distribution of numbers of coins
+struct magnitude {
+    const char *name;
+    uint64_t max_coins;
+};
+
+const magnitude SMALL = {"small", 1000};
+const magnitude MEDIUM = {"medium", uint64_t(1) << 32};
+const magnitude LARGE = {"large", MAX_VALUE};
+
+vector<Moneybag> random_moneybags(const magnitude &distribution, uint64_t seed) {
+    mt19937_64 generator(seed);
+    // Halved, so that sums of two operands do not overflow
+    uniform_int_distribution<uint64_t> coins(0, distribution.max_coins / 2);
+    vector<Moneybag> result;
+    result.reserve(OPERANDS);
+    for (size_t i = 0; i < OPERANDS; i++)
+        result.emplace_back(coins(generator), coins(generator), coins(generator));
+    return result;
+}
+
+// Moneybags close to max possible value, so that additions overflow
+vector<Moneybag> huge_moneybags(uint64_t seed) {
+    mt19937_64 generator(seed);
+    uniform_int_distribution<uint64_t> coins(MAX_VALUE - (uint64_t(1) << 20), MAX_VALUE);
+    vector<Moneybag> result;
+    result.reserve(OPERANDS);
+    for (size_t i = 0; i < OPERANDS; i++)
+        result.emplace_back(coins(generator), coins(generator), coins(generator));
+    return result;
+}
+
+size_t repetitions = REPETITIONS;
+
+// Runs operation on every index of operands, repeated, and prints results.
+// Operation is a template parameter, so that it is inlined into the loop and
+// no indirect call is measured with it.
+template <typename Operation>
+void run(const char *name, const char *distribution, Operation operation) {
+    for (size_t i = 0; i < OPERANDS; i++)
+        operation(i);
+
+    const size_t allocations_before = allocations;
+    const auto start = chrono::steady_clock::now();
+    for (size_t repetition = 0; repetition < repetitions; repetition++)
+        for (size_t i = 0; i < OPERANDS; i++)
+            operation(i);
+    const auto end = chrono::steady_clock::now();
+    const double operations = double(repetitions) * OPERANDS;
+    const double nanoseconds = chrono::duration<double, nano>(end - start).count();
+    printf("%-28s %-8s %10.2f ns/op %8.2f allocs/op\n", name, distribution,
+           nanoseconds / operations, double(allocations - allocations_before) / operations);
+}
+
+void arithmetic_benchmarks(const magnitude &distribution) {
+    const vector<Moneybag> lhs = random_moneybags(distribution, 1);
+    // Right operands not greater than left ones, so that nothing throws
+    vector<Moneybag> rhs;
+    rhs.reserve(OPERANDS);
+    for (size_t i = 0; i < OPERANDS; i++)
+        rhs.emplace_back(lhs[i].livre_number() / 2, lhs[i].solidus_number() / 2,
+                         lhs[i].denier_number() / 2);
+    const uint64_t scalar = distribution.max_coins > (uint64_t(1) << 32) ? 1 : 3;
+
+    run("operator+", distribution.name, [&](size_t i) {
+        Moneybag result = lhs[i] + rhs[i];
+        do_not_optimize(result);
+    });
+    run("operator-", distribution.name, [&](size_t i) {
+        Moneybag result = lhs[i] - rhs[i];
+        do_not_optimize(result);
+    });
+    run("operator*", distribution.name, [&](size_t i) {
+        Moneybag result = rhs[i] * scalar;
+        do_not_optimize(result);
+    });
+    run("SaturatingMoneybag +", distribution.name, [&](size_t i) {
+        SaturatingMoneybag result = SaturatingMoneybag(lhs[i]) + SaturatingMoneybag(lhs[i]);
+        do_not_optimize(result);
+    });
+    run("eager a + b - c * 2", distribution.name, [&](size_t i) {
+        Moneybag result = lhs[i] + lhs[i] - rhs[i] * 2;
+        do_not_optimize(result);
+    });
+    run("lazy a + b - c * 2", distribution.name, [&](size_t i) {
+        Moneybag result = lazy(lhs[i]) + lhs[i] - lazy(rhs[i]) * 2;
+        do_not_optimize(result);
+    });
+    run("Value(Moneybag)", distribution.name, [&](size_t i) {
+        Value result(lhs[i]);
+        do_not_optimize(result);
+    });
+    run("Moneybag <=>", distribution.name, [&](size_t i) {
+        bool result = lhs[i] < rhs[(i + 1) % OPERANDS];
+        do_not_optimize(result);
+    });
+
+    vector<Value> values(lhs.begin(), lhs.end());
+    run("Value <=>", distribution.name, [&](size_t i) {
+        bool result = values[i] < values[(i + 1) % OPERANDS];
+        do_not_optimize(result);
+    });
+    run("Value operator string", distribution.name, [&](size_t i) {
+        string result(values[i]);
+        do_not_optimize(result);
+    });
+    run("to_chars(Value)", distribution.name, [&](size_t i) {
+        char buffer[Value::max_digits];
+        to_chars_result result = to_chars(buffer, buffer + Value::max_digits, values[i]);
+        do_not_optimize(buffer);
+        do_not_optimize(result);
+    });
+
+    null_buffer buffer;
+    ostream os(&buffer);
+    run("operator<<", distribution.name, [&](size_t i) {
+        os << lhs[i];
+    });
+}
+
+void throwing_benchmarks() {
+    const vector<Moneybag> huge = huge_moneybags(2);
+    const vector<Moneybag> small = random_moneybags(SMALL, 3);
+
+    run("operator+ throwing", LARGE.name, [&](size_t i) {
+        try {
+            Moneybag result = huge[i] + huge[(i + 1) % OPERANDS];
+            do_not_optimize(result);
+        } catch (const out_of_range &) {
+        }
+    });
+    run("operator- throwing", SMALL.name, [&](size_t i) {
+        try {
+            Moneybag result = small[i] - huge[i];
+            do_not_optimize(result);
+        } catch (const out_of_range &) {
+        }
+    });
+    run("operator* throwing", LARGE.name, [&](size_t i) {
+        try {
+            Moneybag result = huge[i] * 2;
+            do_not_optimize(result);
+        } catch (const out_of_range &) {
+        }
+    });
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *pointer = malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    free(pointer);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1)
+        repetitions = strtoull(argv[1], nullptr, 10);
+
+    for (const magnitude &distribution : {SMALL, MEDIUM, LARGE})
+        arithmetic_benchmarks(distribution);
+    repetitions = max<size_t>(repetitions / 20, 1);
+    throwing_benchmarks();
+}
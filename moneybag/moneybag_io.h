@@ -0,0 +1,199 @@
+#ifndef MONEYBAG_IO_H_
+#define MONEYBAG_IO_H_
+
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "moneybag.h"
+
+namespace {
+    // Parses text exactly at the beginning of [first, last)
+    inline bool parse_text(const char*& first, const char* last, string_view text) {
+        if ((size_t)(last - first) < text.size()
+            || memcmp(first, text.data(), text.size()) != 0)
+            return false;
+        first += text.size();
+        return true;
+    }
+
+    // Parses number of coins followed by name of coin, plural if needed
+    inline errc parse_coins(const char*& first, const char* last, uint64_t& number,
+                            string_view singular, string_view plural) {
+        const from_chars_result result = from_chars(first, last, number);
+        if (result.ec != errc())
+            return result.ec;
+        first = result.ptr;
+        return parse_text(first, last, number != 1 ? plural : singular)
+               ? errc() : errc::invalid_argument;
+    }
+
+    inline bool is_space(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+}
+
+// Parses text written by operator<<, for example
+// "(1 livr, 2 soliduses, 0 deniers)", from [first, last) without allocating.
+// Like std::from_chars, on failure moneybag is not modified and ec is
+// invalid_argument, or result_out_of_range if a number does not fit.
+template <typename Policy>
+inline from_chars_result from_chars(const char* first, const char* last,
+                                    BasicMoneybag<Policy>& moneybag) {
+    const char* current = first;
+    uint64_t livre = 0, solidus = 0, denier = 0;
+    errc error = parse_text(current, last, "(") ? errc() : errc::invalid_argument;
+    if (error == errc())
+        error = parse_coins(current, last, livre, " livr, ", " livres, ");
+    if (error == errc())
+        error = parse_coins(current, last, solidus, " solidus, ", " soliduses, ");
+    if (error == errc())
+        error = parse_coins(current, last, denier, " denier)", " deniers)");
+    if (error != errc())
+        return {first, error};
+    moneybag = BasicMoneybag<Policy>(livre, solidus, denier);
+    return {current, errc()};
+}
+
+// Parses whitespace separated Moneybags from [first, last) and calls function
+// with each of them. Stops at the end of input or at the first invalid entry,
+// returns where it stopped.
+template <typename Policy = CheckedArithmetic, typename Function>
+inline from_chars_result for_each_moneybag(const char* first, const char* last,
+                                           Function function) {
+    BasicMoneybag<Policy> moneybag(0, 0, 0);
+    while (true) {
+        while (first != last && is_space(*first))
+            ++first;
+        if (first == last)
+            return {first, errc()};
+        const from_chars_result result = from_chars(first, last, moneybag);
+        if (result.ec != errc())
+            return result;
+        function(moneybag);
+        first = result.ptr;
+    }
+}
+
+// Binary ledger: header followed by packed array of (livre, solidus, denier)
+// triples of 64-bit numbers in native byte order. Records have exactly the
+// layout of Moneybag, so a mapped ledger is used as a span of Moneybags
+// without decoding.
+
+static_assert(sizeof(Moneybag) == 3 * sizeof(uint64_t));
+static_assert(is_trivially_copyable_v<Moneybag> && is_standard_layout_v<Moneybag>);
+
+struct LedgerHeader {
+    char magic[8];
+    uint64_t count;
+};
+
+inline constexpr char LEDGER_MAGIC[8] = {'M', 'B', 'L', 'E', 'D', 'G', 'E', 'R'};
+
+// Size in bytes of ledger with given number of records
+constexpr size_t ledger_size(size_t count) {
+    return sizeof(LedgerHeader) + count * sizeof(Moneybag);
+}
+
+// Writes any contiguous range of Moneybags, like vector, array or span
+template <ranges::contiguous_range Moneybags,
+          typename Policy = typename ranges::range_value_t<Moneybags>::policy_t>
+    requires ranges::sized_range<Moneybags>
+             && same_as<ranges::range_value_t<Moneybags>, BasicMoneybag<Policy>>
+inline void write_ledger(ostream& os, const Moneybags& moneybags) {
+    const span<const BasicMoneybag<Policy>> records(ranges::data(moneybags),
+                                                    ranges::size(moneybags));
+    LedgerHeader header;
+    memcpy(header.magic, LEDGER_MAGIC, sizeof(LEDGER_MAGIC));
+    header.count = records.size();
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char*>(records.data()), records.size_bytes());
+}
+
+// Views ledger stored in memory, which has to be aligned to 8 bytes.
+// Throws invalid_argument if data is not a valid ledger.
+template <typename Policy = CheckedArithmetic>
+inline span<const BasicMoneybag<Policy>> view_ledger(const void* data, size_t size) {
+    if (reinterpret_cast<uintptr_t>(data) % alignof(BasicMoneybag<Policy>) != 0)
+        throw invalid_argument("Ledger is not aligned");
+    if (size < sizeof(LedgerHeader))
+        throw invalid_argument("Ledger is too short");
+    LedgerHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, LEDGER_MAGIC, sizeof(LEDGER_MAGIC)) != 0)
+        throw invalid_argument("Not a ledger");
+    if ((size - sizeof(LedgerHeader)) / sizeof(BasicMoneybag<Policy>) < header.count)
+        throw invalid_argument("Ledger is too short");
+    const auto* records = launder(reinterpret_cast<const BasicMoneybag<Policy>*>(
+        static_cast<const char*>(data) + sizeof(LedgerHeader)));
+    return span<const BasicMoneybag<Policy>>(records, header.count);
+}
+
+#if __has_include(<sys/mman.h>)
+
+// Ledger file mapped into memory, read only
+class MappedLedger {
+public:
+    explicit MappedLedger(const char* path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            throw system_error(errno, system_category(), "Cannot open ledger");
+        struct stat info;
+        if (fstat(fd, &info) < 0) {
+            const int error = errno;
+            close(fd);
+            throw system_error(error, system_category(), "Cannot open ledger");
+        }
+        size = info.st_size;
+        data = size == 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        const int error = errno;
+        close(fd);
+        if (data == MAP_FAILED) {
+            if (size == 0)
+                throw invalid_argument("Ledger is too short");
+            throw system_error(error, system_category(), "Cannot map ledger");
+        }
+        try {
+            moneybags = view_ledger(data, size);
+        } catch (...) {
+            munmap(data, size);
+            throw;
+        }
+    }
+
+    MappedLedger(const MappedLedger&) = delete;
+    MappedLedger& operator=(const MappedLedger&) = delete;
+
+    ~MappedLedger() {
+        munmap(data, size);
+    }
+
+    span<const Moneybag> records() const noexcept {
+        return moneybags;
+    }
+
+private:
+    void* data;
+    size_t size;
+    span<const Moneybag> moneybags;
+};
+
+#endif
+
+#endif // MONEYBAG_IO_H_
@@ -0,0 +1,94 @@
+#ifndef NORMALIZED_MONEYBAG_H_
+#define NORMALIZED_MONEYBAG_H_
+
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+#include "moneybag.h"
+
+// Canonical representation of amount of money: deniers exceeding a solidus
+// are carried into soliduses and soliduses exceeding a livre into livres.
+// Value is computed once at construction, so equality, hashing and ordering
+// cost one 128-bit comparison. Unlike Moneybag, ordering is total and follows
+// the worth of coins. Livres may not fit into 64 bits.
+
+class NormalizedMoneybag {
+public:
+    using coin_number_t = uint64_t;
+
+    // Number of deniers in solidus and soliduses in livre
+    static constexpr coin_number_t deniers_in_solidus = 12;
+    static constexpr coin_number_t soliduses_in_livre = 20;
+
+    constexpr NormalizedMoneybag() : value_cache(), livre(0), solidus(0), denier(0) {}
+
+    constexpr explicit NormalizedMoneybag(const Value& value) : value_cache(value),
+    livre(0), solidus(0), denier(0) {
+        constexpr coin_number_t deniers_in_livre = deniers_in_solidus * soliduses_in_livre;
+        const Value::value_t deniers = value.get_value();
+        coin_number_t rest = 0;
+        // 64-bit division is much faster, use it whenever possible
+        if (deniers <= MAX_VALUE) {
+            livre = (coin_number_t)deniers / deniers_in_livre;
+            rest = (coin_number_t)deniers % deniers_in_livre;
+        } else {
+            livre = deniers / deniers_in_livre;
+            rest = (coin_number_t)(deniers % deniers_in_livre);
+        }
+        solidus = rest / deniers_in_solidus;
+        denier = rest % deniers_in_solidus;
+    }
+
+    template <typename Policy>
+    constexpr explicit NormalizedMoneybag(const BasicMoneybag<Policy>& moneybag) :
+    NormalizedMoneybag(Value(moneybag)) {}
+
+    constexpr Value::value_t livre_number() const {
+        return livre;
+    }
+
+    constexpr coin_number_t solidus_number() const {
+        return solidus;
+    }
+
+    constexpr coin_number_t denier_number() const {
+        return denier;
+    }
+
+    constexpr const Value& value() const {
+        return value_cache;
+    }
+
+    // Converts back to Moneybag, throws out_of_range if livres do not fit
+    template <typename Policy>
+    constexpr explicit operator BasicMoneybag<Policy>() const {
+        if (livre > MAX_VALUE)
+            throw out_of_range("Cannot convert livres, it exceeds max possible value");
+        return BasicMoneybag<Policy>((coin_number_t)livre, solidus, denier);
+    }
+
+    constexpr bool operator==(const NormalizedMoneybag& other) const {
+        return value_cache.get_value() == other.value_cache.get_value();
+    }
+
+    constexpr strong_ordering operator<=>(const NormalizedMoneybag& other) const {
+        return value_cache.get_value() <=> other.value_cache.get_value();
+    }
+
+private:
+    Value value_cache;
+    Value::value_t livre;
+    coin_number_t solidus;
+    coin_number_t denier;
+};
+
+template <>
+struct std::hash<NormalizedMoneybag> {
+    size_t operator()(const NormalizedMoneybag& moneybag) const noexcept {
+        return std::hash<Value>()(moneybag.value());
+    }
+};
+
+#endif // NORMALIZED_MONEYBAG_H_
@@ -0,0 +1,125 @@
+#ifndef VALUE_SORT_H_
+#define VALUE_SORT_H_
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <ranges>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "moneybag.h"
+
+// Bulk ordering of Values and of (Value, id) pairs. Keys are compared as
+// plain 128-bit numbers, without going through partial_ordering.
+
+namespace {
+    // Radix sort works on digits of 8 bits
+    constexpr size_t RADIX_BITS = 8;
+    constexpr size_t RADIX_SIZE = size_t(1) << RADIX_BITS;
+    constexpr size_t RADIX_DIGITS = 128 / RADIX_BITS;
+
+    inline Value::value_t sort_key(const Value& value) {
+        return value.get_value();
+    }
+
+    template <typename Id>
+    inline Value::value_t sort_key(const pair<Value, Id>& element) {
+        return element.first.get_value();
+    }
+
+    inline size_t radix_digit(Value::value_t key, size_t digit) {
+        return (size_t)(key >> (digit * RADIX_BITS)) & (RADIX_SIZE - 1);
+    }
+
+    // Stable LSD radix sort by sort_key. Digits equal in all keys are found
+    // first and skipped, so small values need only a few passes.
+    template <typename T>
+    void radix_sort_by_key(span<T> elements) {
+        if (elements.size() < 2)
+            return;
+
+        const Value::value_t first_key = sort_key(elements[0]);
+        Value::value_t differing_bits = 0;
+        for (const T& element : elements)
+            differing_bits |= sort_key(element) ^ first_key;
+
+        size_t digits[RADIX_DIGITS];
+        size_t digits_count = 0;
+        for (size_t digit = 0; digit < RADIX_DIGITS; digit++)
+            if (radix_digit(differing_bits, digit) != 0)
+                digits[digits_count++] = digit;
+        if (digits_count == 0)
+            return;
+
+        vector<array<size_t, RADIX_SIZE>> counts(digits_count);
+        for (const T& element : elements) {
+            const Value::value_t key = sort_key(element);
+            for (size_t i = 0; i < digits_count; i++)
+                counts[i][radix_digit(key, digits[i])]++;
+        }
+
+        vector<T> buffer(elements.size());
+        span<T> source = elements;
+        span<T> target(buffer);
+        for (size_t i = 0; i < digits_count; i++) {
+            array<size_t, RADIX_SIZE>& count = counts[i];
+            size_t offset = 0;
+            for (size_t& bucket : count) {
+                const size_t size = bucket;
+                bucket = offset;
+                offset += size;
+            }
+            for (T& element : source)
+                target[count[radix_digit(sort_key(element), digits[i])]++] = move(element);
+            swap(source, target);
+        }
+
+        if (source.data() != elements.data())
+            move(source.begin(), source.end(), elements.begin());
+    }
+
+    // Moves k greatest elements to the front, in descending order
+    template <typename T>
+    void top_k_by_key(span<T> elements, size_t k) {
+        k = min(k, elements.size());
+        const auto greater_key = [](const T& lhs, const T& rhs) {
+            return sort_key(lhs) > sort_key(rhs);
+        };
+        if (k < elements.size())
+            nth_element(elements.begin(), elements.begin() + k, elements.end(),
+                        greater_key);
+        sort(elements.begin(), elements.begin() + k, greater_key);
+    }
+}
+
+// Sorts values in ascending order
+inline void radix_sort(span<Value> values) {
+    radix_sort_by_key(values);
+}
+
+// Sorts pairs in ascending order of values, stable, so pairs with equal
+// values keep their order. Takes any contiguous range, like vector or span.
+template <ranges::contiguous_range Elements,
+          typename Id = typename ranges::range_value_t<Elements>::second_type>
+    requires same_as<ranges::range_value_t<Elements>, pair<Value, Id>>
+void radix_sort(Elements&& elements) {
+    radix_sort_by_key(span<pair<Value, Id>>(elements));
+}
+
+// Moves k greatest values to the front in descending order, the order of the
+// rest is unspecified
+inline void top_k(span<Value> values, size_t k) {
+    top_k_by_key(values, k);
+}
+
+template <ranges::contiguous_range Elements,
+          typename Id = typename ranges::range_value_t<Elements>::second_type>
+    requires same_as<ranges::range_value_t<Elements>, pair<Value, Id>>
+void top_k(Elements&& elements, size_t k) {
+    top_k_by_key(span<pair<Value, Id>>(elements), k);
+}
+
+#endif // VALUE_SORT_H_
@@ -0,0 +1,93 @@
+#ifndef ENCOUNTER_STATS_H
+#define ENCOUNTER_STATS_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "organism.h"
+
+// Statistics of encounters, collected only when ORGANISM_ENCOUNTER_STATS is
+// defined before including organism.h. Otherwise nothing here is included
+// and encounters cost exactly as much as without statistics. Encounters
+// evaluated at compile time are never recorded. Counters are atomic, so
+// statistics may be collected from many threads.
+
+class encounter_stats_t
+{
+public:
+    // Transfers of vitality are counted in buckets by number of bits,
+    // bucket b holds transfers from [2^(b-1), 2^b)
+    static constexpr size_t TRANSFER_BUCKETS = 65;
+
+private:
+    std::array<std::array<std::atomic<uint64_t>, ENCOUNTER_KINDS>, DIETS * DIETS> outcomes{};
+    std::array<std::atomic<uint64_t>, TRANSFER_BUCKETS> transfers{};
+    mutable std::mutex rounds_mutex;
+    std::vector<round_summary_t> rounds;
+
+    static constexpr size_t diet_pair(diet_t diet1, diet_t diet2) {
+        return DIETS * static_cast<size_t>(diet1) + static_cast<size_t>(diet2);
+    }
+
+public:
+    void record_encounter(diet_t diet1, uint64_t vitality1, diet_t diet2,
+                          uint64_t vitality2, const encounter_result_t &result) {
+        outcomes[diet_pair(diet1, diet2)][static_cast<size_t>(result.kind)]
+            .fetch_add(1, std::memory_order_relaxed);
+        // Vitality gained by the organism which ate or won
+        uint64_t transfer = 0;
+        if (result.vitality1 > vitality1)
+            transfer = result.vitality1 - vitality1;
+        else if (result.vitality2 > vitality2)
+            transfer = result.vitality2 - vitality2;
+        if (transfer != 0)
+            transfers[std::bit_width(transfer)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_round(const round_summary_t &summary) {
+        std::lock_guard<std::mutex> lock(rounds_mutex);
+        rounds.push_back(summary);
+    }
+
+    uint64_t outcome_count(diet_t diet1, diet_t diet2, encounter_kind_t kind) const {
+        return outcomes[diet_pair(diet1, diet2)][static_cast<size_t>(kind)]
+            .load(std::memory_order_relaxed);
+    }
+
+    uint64_t transfer_count(size_t bucket) const {
+        return transfers[bucket].load(std::memory_order_relaxed);
+    }
+
+    std::vector<round_summary_t> round_history() const {
+        std::lock_guard<std::mutex> lock(rounds_mutex);
+        return rounds;
+    }
+
+    void reset() {
+        for (auto &pair_outcomes : outcomes)
+            for (std::atomic<uint64_t> &count : pair_outcomes)
+                count.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t> &count : transfers)
+            count.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(rounds_mutex);
+        rounds.clear();
+    }
+};
+
+// Statistics shared by the whole program
+inline encounter_stats_t &encounter_stats() {
+    static encounter_stats_t instance;
+    return instance;
+}
+
+inline void record_encounter(diet_t diet1, uint64_t vitality1, diet_t diet2,
+                             uint64_t vitality2, const encounter_result_t &result) {
+    encounter_stats().record_encounter(diet1, vitality1, diet2, vitality2, result);
+}
+
+#endif /* ENCOUNTER_STATS_H */
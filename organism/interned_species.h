@@ -0,0 +1,98 @@
+#ifndef INTERNED_SPECIES_H
+#define INTERNED_SPECIES_H
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Species represented by a small id from an intern table, to be used as
+// species_t of Organism. Copying is copying one number and species are
+// compared by comparing ids, while names are still available through get().
+// Each pair of name type and tag has its own table, so a simulation may use
+// its own tag to keep its species apart from others. Tables are shared by
+// all threads and never shrink.
+template <typename name_t, typename tag_t = void>
+requires std::equality_comparable<name_t>
+class interned_species
+{
+private:
+    struct table_t
+    {
+        std::shared_mutex mutex;
+        std::unordered_map<name_t, uint32_t> ids;
+        // Deque does not move its elements, so references to names stay valid
+        std::deque<name_t> names;
+    };
+
+    static table_t &table() {
+        static table_t instance;
+        return instance;
+    }
+
+    uint32_t id;
+
+    constexpr explicit interned_species(uint32_t id, int) : id(id) {}
+
+public:
+    explicit interned_species(const name_t &name) {
+        table_t &names = table();
+        {
+            std::shared_lock<std::shared_mutex> lock(names.mutex);
+            auto it = names.ids.find(name);
+            if (it != names.ids.end()) {
+                id = it->second;
+                return;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(names.mutex);
+        auto [it, inserted] = names.ids.try_emplace(name, static_cast<uint32_t>(names.names.size()));
+        if (inserted) {
+            try {
+                names.names.push_back(name);
+            } catch (...) {
+                names.ids.erase(it);
+                throw;
+            }
+        }
+        id = it->second;
+    }
+
+    // Species with given id, which has to be already interned
+    static constexpr interned_species from_id(uint32_t id) {
+        return interned_species(id, 0);
+    }
+
+    constexpr uint32_t get_id() const { return id; }
+
+    const name_t &get() const {
+        table_t &names = table();
+        std::shared_lock<std::shared_mutex> lock(names.mutex);
+        return names.names[id];
+    }
+
+    // Number of species interned so far
+    static size_t count() {
+        table_t &names = table();
+        std::shared_lock<std::shared_mutex> lock(names.mutex);
+        return names.names.size();
+    }
+
+    constexpr bool operator==(const interned_species &other) const = default;
+
+    bool operator==(const name_t &name) const { return get() == name; }
+};
+
+template <typename name_t, typename tag_t>
+struct std::hash<interned_species<name_t, tag_t>>
+{
+    size_t operator()(const interned_species<name_t, tag_t> &species) const noexcept {
+        return std::hash<uint32_t>()(species.get_id());
+    }
+};
+
+#endif /* INTERNED_SPECIES_H */
@@ -2,7 +2,9 @@
 #define ORGANISM_H
 
 #include <tuple>
+#include <type_traits>
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <optional>
 #include <assert.h>
@@ -44,92 +46,192 @@ using Carnivore = Organism<species_t, true, false>;
 template <typename species_t>
 using Plant = Organism<species_t, false, false>;
 
-template <typename species_t, bool sp1_eats_m, bool sp1_eats_p, bool sp2_eats_m, bool sp2_eats_p>
-constexpr std::tuple<Organism<species_t, sp1_eats_m, sp1_eats_p>,
-                     Organism<species_t, sp2_eats_m, sp2_eats_p>,
-                     std::optional<Organism<species_t, sp1_eats_m, sp1_eats_p>>>
-encounter(Organism<species_t, sp1_eats_m, sp1_eats_p> organism1,
-          Organism<species_t, sp2_eats_m, sp2_eats_p> organism2) {
+// Diet of organism known at runtime, bit 1 tells whether it eats meat
+// and bit 0 whether it eats plants
+enum class diet_t : uint8_t
+{
+    plant = 0,
+    herbivore = 1,
+    carnivore = 2,
+    omnivore = 3
+};
 
-    // Plant encountering plant
-    static_assert(!(organism1.is_plant() && organism2.is_plant()));
+constexpr size_t DIETS = 4;
+
+constexpr diet_t make_diet(bool can_eat_meat, bool can_eat_plants) {
+    return static_cast<diet_t>((can_eat_meat ? 2 : 0) | (can_eat_plants ? 1 : 0));
+}
+
+constexpr bool diet_eats_meat(diet_t diet) {
+    return (static_cast<uint8_t>(diet) & 2) != 0;
+}
+
+constexpr bool diet_eats_plants(diet_t diet) {
+    return (static_cast<uint8_t>(diet) & 1) != 0;
+}
+
+// What happened during encounter
+enum class encounter_kind_t : uint8_t
+{
+    dead,           // one of organisms was already dead, nothing happens
+    mating,         // same species, offspring is born
+    fight_both_die, // meat eaters of equal vitality kill each other
+    fight_won,      // meat eaters fight, stronger one wins
+    grazing,        // plant is eaten
+    hunt,           // meat eater eats weaker animal
+    nothing         // meat eater meets plant or fails to hunt
+};
+
+constexpr size_t ENCOUNTER_KINDS = 7;
+
+// Births and deaths during one round of a population
+struct round_summary_t
+{
+    size_t births = 0;
+    size_t deaths = 0;
+};
+
+// Vitalities after encounter, offspring has species and diet of first organism
+struct encounter_result_t
+{
+    uint64_t vitality1;
+    uint64_t vitality2;
+    std::optional<uint64_t> offspring_vitality;
+    encounter_kind_t kind;
+};
+
+#ifdef ORGANISM_ENCOUNTER_STATS
+// Defined in encounter_stats.h
+inline void record_encounter(diet_t diet1, uint64_t vitality1, diet_t diet2,
+                             uint64_t vitality2, const encounter_result_t &result);
+#endif
+
+// Rules of encounter for diets known at runtime, same_species tells whether
+// organisms have the same species, it matters only if they have the same diet
+constexpr encounter_result_t apply_encounter_rules(diet_t diet1, uint64_t vitality1,
+                                                   diet_t diet2, uint64_t vitality2,
+                                                   bool same_species) {
+    const bool eats_meat1 = diet_eats_meat(diet1);
+    const bool eats_meat2 = diet_eats_meat(diet2);
+    const bool eats_plants1 = diet_eats_plants(diet1);
+    const bool eats_plants2 = diet_eats_plants(diet2);
+    const bool is_plant1 = diet1 == diet_t::plant;
+    const bool is_plant2 = diet2 == diet_t::plant;
 
-    const uint64_t vitality1 = organism1.get_vitality();
-    const uint64_t vitality2 = organism2.get_vitality();
-    
     // Encountering dead
     if (vitality1 == 0 || vitality2 == 0) {
-        return std::make_tuple(organism1, organism2, std::nullopt);
+        return {vitality1, vitality2, std::nullopt, encounter_kind_t::dead};
     }
 
     // Mating
-    if ((organism1.get_species() == organism2.get_species()) &&
-        (organism1.eats_meat() == organism2.eats_meat()) &&
-        (organism1.eats_plants() == organism2.eats_plants())){
-        return std::make_tuple(organism1, organism2, 
-                    Organism<species_t, sp1_eats_m, sp1_eats_p>(organism1.get_species(),
-                            (vitality1 + vitality2) / 2));
+    if (same_species && diet1 == diet2) {
+        return {vitality1, vitality2, (vitality1 + vitality2) / 2,
+                encounter_kind_t::mating};
     }
 
     // Fighting
-    if (organism1.eats_meat() && organism2.eats_meat()) {
+    if (eats_meat1 && eats_meat2) {
         if (vitality1 == vitality2) {
-            organism1.set_vitality(0);
-            organism2.set_vitality(0);
+            return {0, 0, std::nullopt, encounter_kind_t::fight_both_die};
         } else if (vitality1 > vitality2) {
-            organism1.set_vitality(vitality1 + vitality2 / 2);
-            organism2.set_vitality(0);
+            return {vitality1 + vitality2 / 2, 0, std::nullopt,
+                    encounter_kind_t::fight_won};
         } else {
-            organism2.set_vitality(vitality2+vitality1 / 2);
-            organism1.set_vitality(0);
+            return {0, vitality2 + vitality1 / 2, std::nullopt,
+                    encounter_kind_t::fight_won};
         }
-        return std::make_tuple(organism1, organism2, std::nullopt);
     }
 
     // Eating plant encounters plant
-    if (organism1.eats_plants() && organism2.is_plant()) {
-        organism1.set_vitality(vitality1 + vitality2);
-        organism2.set_vitality(0);
-        return std::make_tuple(organism1, organism2, std::nullopt);
+    if (eats_plants1 && is_plant2) {
+        return {vitality1 + vitality2, 0, std::nullopt, encounter_kind_t::grazing};
     }
-    if (organism2.eats_plants() && organism1.is_plant()) {
-        organism2.set_vitality(vitality1 + vitality2);
-        organism1.set_vitality(0);
-        return std::make_tuple(organism1, organism2, std::nullopt);
+    if (eats_plants2 && is_plant1) {
+        return {0, vitality1 + vitality2, std::nullopt, encounter_kind_t::grazing};
     }
 
     // Eating meat encounters animal
-    if (organism1.eats_meat() && !organism2.is_plant() && vitality1 > vitality2) {
-        organism1.set_vitality(vitality1+vitality2/2);
-        organism2.set_vitality(0);
-        return std::make_tuple(organism1, organism2, std::nullopt);
-    } 
-
-    if (organism2.eats_meat() && !organism1.is_plant() && vitality2 > vitality1) {
-        organism2.set_vitality(vitality2 + vitality1/2);
-        organism1.set_vitality(0);
-        return std::make_tuple(organism1, organism2, std::nullopt);
-    } 
+    if (eats_meat1 && !is_plant2 && vitality1 > vitality2) {
+        return {vitality1 + vitality2 / 2, 0, std::nullopt, encounter_kind_t::hunt};
+    }
+    if (eats_meat2 && !is_plant1 && vitality2 > vitality1) {
+        return {0, vitality2 + vitality1 / 2, std::nullopt, encounter_kind_t::hunt};
+    }
+
     // Last case, eating meat encounter plant
     // Or meat eater does not have enough vitality to 
     // eat other animal
-    return std::make_tuple(organism1, organism2, std::nullopt);
+    return {vitality1, vitality2, std::nullopt, encounter_kind_t::nothing};
 }
 
-template <typename species_t, bool sp1_eats_m, bool sp1_eats_p,
-bool sp2_eats_m, bool sp2_eats_p, typename... Args>
-constexpr Organism<species_t, sp1_eats_m, sp1_eats_p>
-encounter_series(Organism<species_t, sp1_eats_m, sp1_eats_p> organism1,
-Organism<species_t, sp2_eats_m, sp2_eats_p> organism2, Args... args) {
-    return encounter_series(std::get<0>(encounter(organism1, organism2)), args...);
+// Resolves encounter, with ORGANISM_ENCOUNTER_STATS defined it is also
+// recorded in statistics unless evaluated at compile time
+constexpr encounter_result_t resolve_encounter(diet_t diet1, uint64_t vitality1,
+                                               diet_t diet2, uint64_t vitality2,
+                                               bool same_species) {
+    const encounter_result_t result =
+        apply_encounter_rules(diet1, vitality1, diet2, vitality2, same_species);
+#ifdef ORGANISM_ENCOUNTER_STATS
+    if (!std::is_constant_evaluated())
+        record_encounter(diet1, vitality1, diet2, vitality2, result);
+#endif
+    return result;
+}
+
+template <typename species_t, bool sp1_eats_m, bool sp1_eats_p, bool sp2_eats_m, bool sp2_eats_p>
+constexpr std::tuple<Organism<species_t, sp1_eats_m, sp1_eats_p>,
+                     Organism<species_t, sp2_eats_m, sp2_eats_p>,
+                     std::optional<Organism<species_t, sp1_eats_m, sp1_eats_p>>>
+encounter(Organism<species_t, sp1_eats_m, sp1_eats_p> organism1,
+          Organism<species_t, sp2_eats_m, sp2_eats_p> organism2) {
+
+    // Plant encountering plant
+    static_assert(!(organism1.is_plant() && organism2.is_plant()));
+
+    const uint64_t vitality1 = organism1.get_vitality();
+    const uint64_t vitality2 = organism2.get_vitality();
+
+    // Species are compared only when it may lead to mating
+    const bool same_species = sp1_eats_m == sp2_eats_m && sp1_eats_p == sp2_eats_p &&
+                              vitality1 != 0 && vitality2 != 0 &&
+                              organism1.get_species() == organism2.get_species();
+
+    const encounter_result_t result =
+        resolve_encounter(make_diet(sp1_eats_m, sp1_eats_p), vitality1,
+                          make_diet(sp2_eats_m, sp2_eats_p), vitality2, same_species);
+
+    if (result.offspring_vitality.has_value()) {
+        return std::make_tuple(organism1, organism2,
+                    Organism<species_t, sp1_eats_m, sp1_eats_p>(organism1.get_species(),
+                            *result.offspring_vitality));
+    }
+
+    organism1.set_vitality(result.vitality1);
+    organism2.set_vitality(result.vitality2);
+    return std::make_tuple(organism1, organism2, std::nullopt);
 }
 
+// Tells whether T is an organism with given species type
+template <typename species_t, typename T>
+struct is_organism_of : std::false_type {};
+
+template <typename species_t, bool can_eat_meat, bool can_eat_plants>
+struct is_organism_of<species_t, Organism<species_t, can_eat_meat, can_eat_plants>>
+    : std::true_type {};
+
+// First organism meets all others in order. Implemented as a fold over
+// arguments, so that the series needs one instantiation of itself and one of
+// encounter per distinct type of argument, rather than one per argument.
 template <typename species_t, bool sp1_eats_m, bool sp1_eats_p, typename... Args>
+requires (is_organism_of<species_t, Args>::value && ...)
 constexpr Organism<species_t, sp1_eats_m, sp1_eats_p>
-encounter_series(Organism<species_t, sp1_eats_m, sp1_eats_p> organism1) {
+encounter_series(Organism<species_t, sp1_eats_m, sp1_eats_p> organism1, Args... args) {
+    (organism1.set_vitality(std::get<0>(encounter(organism1, args)).get_vitality()), ...);
     return organism1;
 }
 
-
+#ifdef ORGANISM_ENCOUNTER_STATS
+#include "encounter_stats.h"
+#endif
 
 #endif /* ORGANISM_H */
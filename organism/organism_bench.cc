@@ -0,0 +1,182 @@
+// Benchmark of encounters of organisms.
+// Build and run with:
+//     g++ -std=c++20 -O2 organism_bench.cc -o organism_bench
+//     ./organism_bench [organisms] [compiler]
+// Measures runtime throughput of encounter for each pair of diets with
+// integer, std::string and std::string_view species, the part of it spent on
+// copying organisms through the returned tuple and short encounter_series.
+// If compiler is given, also measures build time of series_bench.cc, where long
+// series are evaluated as constant expressions.
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "organism.h"
+
+namespace {
+
+// Number of heap allocations made so far
+size_t allocations = 0;
+
+// Number of organisms of each diet
+size_t organisms = 1 << 16;
+
+const size_t REPETITIONS = 20;
+
+const size_t SPECIES = 8;
+
+template <typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "m"(value) : "memory");
+}
+
+// Names long enough not to fit into small string buffer
+const std::string NAMES[SPECIES] = {
+    "Canis lupus familiaris", "Felis silvestris catus", "Bos primigenius taurus",
+    "Ovis aries aries domestica", "Ursus arctos horribilis", "Cervus elaphus hippelaphus",
+    "Triticum aestivum vulgare", "Quercus robur pedunculata"};
+
+template <typename species_t>
+species_t make_species(size_t index) {
+    if constexpr (std::is_integral_v<species_t>)
+        return static_cast<species_t>(index);
+    else
+        return species_t(NAMES[index]);
+}
+
+template <typename species_t, bool can_eat_meat, bool can_eat_plants>
+std::vector<Organism<species_t, can_eat_meat, can_eat_plants>> make_organisms(uint64_t seed) {
+    std::mt19937_64 generator(seed);
+    std::vector<Organism<species_t, can_eat_meat, can_eat_plants>> result;
+    result.reserve(organisms);
+    for (size_t i = 0; i < organisms; i++)
+        result.emplace_back(make_species<species_t>(generator() % SPECIES),
+                            generator() % 100 + (i % 16 == 0 ? 0 : 1));
+    return result;
+}
+
+const char *diet_name(bool can_eat_meat, bool can_eat_plants) {
+    if (can_eat_meat)
+        return can_eat_plants ? "omnivore" : "carnivore";
+    return can_eat_plants ? "herbivore" : "plant";
+}
+
+// Runs operation for every organism index, repeated, and prints results
+template <typename Operation>
+void run(const char *type, const char *name, bool m1, bool p1, bool m2, bool p2,
+         Operation operation) {
+    for (size_t i = 0; i < organisms; i++)
+        operation(i);
+    const size_t allocations_before = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t repetition = 0; repetition < REPETITIONS; repetition++)
+        for (size_t i = 0; i < organisms; i++)
+            operation(i);
+    const auto end = std::chrono::steady_clock::now();
+    const double operations = double(REPETITIONS) * organisms;
+    printf("%-12s %-18s %-9s x %-9s %8.2f ns/op %6.2f allocs/op\n", type, name,
+           diet_name(m1, p1), diet_name(m2, p2),
+           std::chrono::duration<double, std::nano>(end - start).count() / operations,
+           double(allocations - allocations_before) / operations);
+}
+
+template <typename species_t, bool m1, bool p1, bool m2, bool p2>
+void bench_pair(const char *type) {
+    if constexpr (!(!m1 && !p1 && !m2 && !p2)) {
+        const auto first = make_organisms<species_t, m1, p1>(1);
+        const auto second = make_organisms<species_t, m2, p2>(2);
+
+        run(type, "encounter", m1, p1, m2, p2, [&](size_t i) {
+            auto result = encounter(first[i], second[i]);
+            do_not_optimize(std::get<0>(result).get_vitality());
+        });
+        // Rules alone, without copying organisms into and out of encounter
+        run(type, "rules only", m1, p1, m2, p2, [&](size_t i) {
+            const bool same_species = m1 == m2 && p1 == p2 &&
+                                      first[i].get_species() == second[i].get_species();
+            auto result = resolve_encounter(make_diet(m1, p1), first[i].get_vitality(),
+                                            make_diet(m2, p2), second[i].get_vitality(),
+                                            same_species);
+            do_not_optimize(result);
+        });
+        run(type, "tuple copy", m1, p1, m2, p2, [&](size_t i) {
+            auto result = std::make_tuple(first[i], second[i],
+                std::optional<Organism<species_t, m1, p1>>(first[i]));
+            do_not_optimize(result);
+        });
+        run(type, "series of 4", m1, p1, m2, p2, [&](size_t i) {
+            const size_t mask = organisms - 1;
+            auto result = encounter_series(first[i], second[i], second[(i + 1) & mask],
+                                           second[(i + 2) & mask], second[(i + 3) & mask]);
+            do_not_optimize(result.get_vitality());
+        });
+    }
+}
+
+template <typename species_t, size_t pair = 0>
+void bench_all_pairs(const char *type) {
+    if constexpr (pair < 16) {
+        bench_pair<species_t, (pair & 8) != 0, (pair & 4) != 0,
+                   (pair & 2) != 0, (pair & 1) != 0>(type);
+        bench_all_pairs<species_t, pair + 1>(type);
+    }
+}
+
+// Measures build time of series_bench.cc for growing series
+void bench_compile_time(const char *compiler) {
+    for (const char *flags : {"", " -DSERIES_RUNTIME"}) {
+        for (int length : {10, 100, 1000}) {
+            const std::string command = std::string(compiler) +
+                " -std=c++20 -o /dev/null series_bench.cc -DSERIES_LENGTH=" +
+                std::to_string(length) + flags;
+            const auto start = std::chrono::steady_clock::now();
+            const int status = std::system(command.c_str());
+            const auto end = std::chrono::steady_clock::now();
+            printf("series of %4d %-9s build %8.2f s%s\n", length,
+                   *flags ? "runtime" : "constexpr",
+                   std::chrono::duration<double>(end - start).count(),
+                   status == 0 ? "" : " (failed)");
+        }
+    }
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *pointer = malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+// Kept out of line, otherwise GCC mistakes inlined free for a mismatched pair
+[[gnu::noinline]] void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void *pointer, size_t) noexcept {
+    free(pointer);
+}
+
+int main(int argc, char *argv[]) {
+    // Rounded down to a power of two, so that series can wrap with a mask
+    if (argc > 1)
+        organisms = std::bit_floor(std::max<size_t>(strtoull(argv[1], nullptr, 10), 1));
+
+    bench_all_pairs<uint64_t>("integer");
+    bench_all_pairs<std::string>("string");
+    bench_all_pairs<std::string_view>("string_view");
+
+    if (argc > 2)
+        bench_compile_time(argv[2]);
+}
@@ -0,0 +1,296 @@
+#ifndef POPULATION_H
+#define POPULATION_H
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "organism.h"
+#include "work_stealing_pool.h"
+
+template <typename species_t>
+struct population_snapshot_t;
+
+// Generator of pseudorandom numbers (SplitMix64), its whole state is one
+// number, so it is cheap to store and restore
+class population_random_t
+{
+private:
+    uint64_t state;
+
+public:
+    constexpr explicit population_random_t(uint64_t seed) : state(seed) {}
+    constexpr uint64_t get_state() const { return state; }
+    constexpr void set_state(uint64_t new_state) { state = new_state; }
+
+    constexpr uint64_t operator()() {
+        uint64_t result = (state += 0x9e3779b97f4a7c15u);
+        result = (result ^ (result >> 30)) * 0xbf58476d1ce4e5b9u;
+        result = (result ^ (result >> 27)) * 0x94d049bb133111ebu;
+        return result ^ (result >> 31);
+    }
+
+    // Number from [0, bound)
+    constexpr uint64_t below(uint64_t bound) {
+        return static_cast<uint64_t>((static_cast<__uint128_t>((*this)()) * bound) >> 64);
+    }
+};
+
+// Population of organisms of one species type, with diets known at runtime.
+// Organisms of each diet are kept in structure of arrays: species and
+// vitalities in separate vectors. In each round organisms are shuffled and
+// paired, and each pair meets according to rules of encounter. Plants do not
+// meet plants. Offspring joins the population after the round, dead organisms
+// are removed at its end.
+template <typename species_t>
+requires std::equality_comparable<species_t>
+class Population
+{
+private:
+    struct diet_group_t
+    {
+        std::vector<species_t> species;
+        std::vector<uint64_t> vitality;
+    };
+
+    // Position of organism in its group
+    struct handle_t
+    {
+        uint32_t index;
+        diet_t diet;
+    };
+
+    friend struct population_snapshot_t<species_t>;
+
+    std::array<diet_group_t, DIETS> groups;
+    population_random_t random;
+
+    // Offspring of one chunk of pairs, positions in buffer of a thread
+    struct chunk_offspring_t
+    {
+        size_t chunk;
+        size_t worker;
+        std::array<size_t, DIETS> first;
+        std::array<size_t, DIETS> last;
+    };
+
+    // Offspring collected by one thread during parallel round
+    struct worker_offspring_t
+    {
+        std::array<diet_group_t, DIETS> children;
+        std::vector<chunk_offspring_t> chunks;
+    };
+
+    // Number of pairs handled by one task of parallel round
+    static constexpr size_t CHUNK_PAIRS = 4096;
+
+    // Reused between rounds to avoid allocations
+    std::vector<handle_t> order;
+    std::array<diet_group_t, DIETS> offspring;
+    std::vector<worker_offspring_t> worker_offspring;
+
+    diet_group_t &group(diet_t diet) {
+        return groups[static_cast<size_t>(diet)];
+    }
+
+    const diet_group_t &group(diet_t diet) const {
+        return groups[static_cast<size_t>(diet)];
+    }
+
+    // Fills order with all organisms in random order
+    void shuffle_organisms() {
+        order.clear();
+        for (size_t diet = 0; diet < DIETS; diet++)
+            for (size_t i = 0; i < groups[diet].vitality.size(); i++)
+                order.push_back({static_cast<uint32_t>(i), static_cast<diet_t>(diet)});
+        for (size_t i = order.size(); i > 1; i--)
+            std::swap(order[i - 1], order[random.below(i)]);
+    }
+
+    // Resolves encounters of pairs [first, last) of order, offspring is
+    // appended to given groups
+    void meet_pairs(size_t first, size_t last, std::array<diet_group_t, DIETS> &children) {
+        for (size_t pair = first; pair < last; pair++) {
+            const handle_t handle1 = order[2 * pair];
+            const handle_t handle2 = order[2 * pair + 1];
+            if (handle1.diet == diet_t::plant && handle2.diet == diet_t::plant)
+                continue;
+
+            diet_group_t &group1 = group(handle1.diet);
+            diet_group_t &group2 = group(handle2.diet);
+            uint64_t &vitality1 = group1.vitality[handle1.index];
+            uint64_t &vitality2 = group2.vitality[handle2.index];
+            const bool same_species = handle1.diet == handle2.diet &&
+                                      vitality1 != 0 && vitality2 != 0 &&
+                                      group1.species[handle1.index] ==
+                                      group2.species[handle2.index];
+
+            const encounter_result_t result =
+                resolve_encounter(handle1.diet, vitality1, handle2.diet, vitality2,
+                                  same_species);
+            vitality1 = result.vitality1;
+            vitality2 = result.vitality2;
+            if (result.offspring_vitality.has_value()) {
+                diet_group_t &children_group = children[static_cast<size_t>(handle1.diet)];
+                children_group.species.push_back(group1.species[handle1.index]);
+                children_group.vitality.push_back(*result.offspring_vitality);
+            }
+        }
+    }
+
+    // Moves offspring to population, returns number of births
+    size_t add_offspring(std::array<diet_group_t, DIETS> &children) {
+        size_t births = 0;
+        for (size_t diet = 0; diet < DIETS; diet++) {
+            diet_group_t &from = children[diet];
+            diet_group_t &to = groups[diet];
+            births += from.vitality.size();
+            to.species.insert(to.species.end(), std::make_move_iterator(from.species.begin()),
+                              std::make_move_iterator(from.species.end()));
+            to.vitality.insert(to.vitality.end(), from.vitality.begin(), from.vitality.end());
+            from.species.clear();
+            from.vitality.clear();
+        }
+        return births;
+    }
+
+    void clear_worker_offspring() {
+        for (worker_offspring_t &worker : worker_offspring) {
+            for (diet_group_t &children : worker.children) {
+                children.species.clear();
+                children.vitality.clear();
+            }
+            worker.chunks.clear();
+        }
+    }
+
+    // Moves offspring collected by workers to population in order of chunks,
+    // so that result does not depend on number of threads
+    size_t add_worker_offspring() {
+        std::vector<chunk_offspring_t> chunks;
+        for (worker_offspring_t &worker : worker_offspring)
+            chunks.insert(chunks.end(), worker.chunks.begin(), worker.chunks.end());
+        std::sort(chunks.begin(), chunks.end(),
+                  [](const chunk_offspring_t &lhs, const chunk_offspring_t &rhs) {
+                      return lhs.chunk < rhs.chunk;
+                  });
+
+        size_t births = 0;
+        for (const chunk_offspring_t &chunk : chunks) {
+            std::array<diet_group_t, DIETS> &children = worker_offspring[chunk.worker].children;
+            for (size_t diet = 0; diet < DIETS; diet++) {
+                diet_group_t &from = children[diet];
+                diet_group_t &to = groups[diet];
+                births += chunk.last[diet] - chunk.first[diet];
+                to.species.insert(to.species.end(),
+                                  std::make_move_iterator(from.species.begin() + chunk.first[diet]),
+                                  std::make_move_iterator(from.species.begin() + chunk.last[diet]));
+                to.vitality.insert(to.vitality.end(), from.vitality.begin() + chunk.first[diet],
+                                   from.vitality.begin() + chunk.last[diet]);
+            }
+        }
+        clear_worker_offspring();
+        return births;
+    }
+
+    // Removes dead organisms keeping order of others, returns number of deaths
+    size_t compact() {
+        size_t deaths = 0;
+        for (diet_group_t &current : groups) {
+            size_t alive = 0;
+            for (size_t i = 0; i < current.vitality.size(); i++) {
+                if (current.vitality[i] == 0)
+                    continue;
+                if (alive != i) {
+                    current.species[alive] = std::move(current.species[i]);
+                    current.vitality[alive] = current.vitality[i];
+                }
+                alive++;
+            }
+            deaths += current.vitality.size() - alive;
+            current.species.erase(current.species.begin() + alive, current.species.end());
+            current.vitality.resize(alive);
+        }
+        return deaths;
+    }
+
+public:
+    explicit Population(uint64_t seed = 0) : random(seed) {}
+
+    void add(diet_t diet, const species_t &species, uint64_t vitality) {
+        diet_group_t &to = group(diet);
+        to.species.push_back(species);
+        to.vitality.push_back(vitality);
+    }
+
+    template <bool can_eat_meat, bool can_eat_plants>
+    void add(const Organism<species_t, can_eat_meat, can_eat_plants> &organism) {
+        add(make_diet(can_eat_meat, can_eat_plants), organism.get_species(),
+            organism.get_vitality());
+    }
+
+    size_t size() const {
+        size_t result = 0;
+        for (const diet_group_t &current : groups)
+            result += current.vitality.size();
+        return result;
+    }
+
+    size_t size(diet_t diet) const { return group(diet).vitality.size(); }
+
+    std::span<const species_t> species(diet_t diet) const { return group(diet).species; }
+
+    std::span<const uint64_t> vitalities(diet_t diet) const { return group(diet).vitality; }
+
+    // Runs one round of encounters
+    round_summary_t run_round() {
+        shuffle_organisms();
+        meet_pairs(0, order.size() / 2, offspring);
+        round_summary_t summary;
+        summary.births = add_offspring(offspring);
+        summary.deaths = compact();
+#ifdef ORGANISM_ENCOUNTER_STATS
+        encounter_stats().record_round(summary);
+#endif
+        return summary;
+    }
+
+    // Runs one round of encounters on threads of pool. Pairs are disjoint,
+    // so no organism takes part in two concurrent encounters. The result is
+    // the same as of run_round() without pool, whatever the number of threads.
+    round_summary_t run_round(work_stealing_pool_t &pool) {
+        shuffle_organisms();
+        const size_t pairs = order.size() / 2;
+        const size_t chunks = (pairs + CHUNK_PAIRS - 1) / CHUNK_PAIRS;
+        worker_offspring.resize(std::max(worker_offspring.size(), pool.size()));
+        // buffers are left filled if previous parallel round threw
+        clear_worker_offspring();
+
+        pool.run(chunks, [&](size_t chunk, size_t worker) {
+            worker_offspring_t &buffer = worker_offspring[worker];
+            chunk_offspring_t positions{chunk, worker, {}, {}};
+            for (size_t diet = 0; diet < DIETS; diet++)
+                positions.first[diet] = buffer.children[diet].vitality.size();
+            meet_pairs(chunk * CHUNK_PAIRS, std::min(pairs, (chunk + 1) * CHUNK_PAIRS),
+                       buffer.children);
+            for (size_t diet = 0; diet < DIETS; diet++)
+                positions.last[diet] = buffer.children[diet].vitality.size();
+            buffer.chunks.push_back(positions);
+        });
+
+        round_summary_t summary;
+        summary.births = add_worker_offspring();
+        summary.deaths = compact();
+#ifdef ORGANISM_ENCOUNTER_STATS
+        encounter_stats().record_round(summary);
+#endif
+        return summary;
+    }
+};
+
+#endif /* POPULATION_H */
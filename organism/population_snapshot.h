@@ -0,0 +1,138 @@
+#ifndef POPULATION_SNAPSHOT_H
+#define POPULATION_SNAPSHOT_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "population.h"
+
+// Binary snapshots of populations. A snapshot consists of a header followed,
+// for each diet, by the array of species and the array of vitalities, both
+// stored exactly as in memory. Therefore species_t has to be trivially
+// copyable, like interned_species (then ids are valid only with the same
+// intern table) or integer ids. Saving and restoring the generator state
+// makes restored simulation continue exactly as the original one.
+template <typename species_t>
+struct population_snapshot_t
+{
+    static_assert(std::is_trivially_copyable_v<species_t>,
+                  "species have to be trivially copyable to be stored in snapshot");
+
+    struct header_t
+    {
+        char magic[8];
+        uint64_t species_size;
+        uint64_t random_state;
+        uint64_t counts[DIETS];
+    };
+
+    static constexpr char MAGIC[8] = {'O', 'R', 'G', 'S', 'N', 'A', 'P', '1'};
+
+    // Bytes read from stream at once, counts in header are not trusted, so
+    // memory grows only as far as the stream really holds data
+    static constexpr size_t READ_CHUNK = size_t(1) << 20;
+
+    // Reads count elements to the end of array, which is filled with filler
+    // before reading over it
+    template <typename T>
+    static void read_array(std::istream &is, std::vector<T> &array, size_t count, T filler) {
+        const size_t chunk_elements = READ_CHUNK / sizeof(T);
+        while (count > 0) {
+            const size_t start = array.size();
+            const size_t elements = std::min(chunk_elements, count);
+            array.resize(start + elements, filler);
+            if (!is.read(reinterpret_cast<char *>(array.data() + start), elements * sizeof(T)))
+                throw std::invalid_argument("Snapshot is too short");
+            count -= elements;
+        }
+    }
+
+    static void write(const Population<species_t> &population, std::ostream &os) {
+        header_t header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.species_size = sizeof(species_t);
+        header.random_state = population.random.get_state();
+        for (size_t diet = 0; diet < DIETS; diet++)
+            header.counts[diet] = population.groups[diet].vitality.size();
+        os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (const auto &group : population.groups) {
+            os.write(reinterpret_cast<const char *>(group.species.data()),
+                     group.species.size() * sizeof(species_t));
+            os.write(reinterpret_cast<const char *>(group.vitality.data()),
+                     group.vitality.size() * sizeof(uint64_t));
+        }
+        if (!os)
+            throw std::runtime_error("Cannot write snapshot");
+    }
+
+    // Copies population and writes the copy to file on another thread, so that
+    // simulation may go on while the file is written. The copy is made on the
+    // calling thread, it takes time linear in the size of population, though
+    // only for copying of arrays, and as much memory again until the file is
+    // written. Arrays change in every round, so writing them in place would
+    // need copy-on-write in Population. Errors are reported by the returned
+    // future.
+    static std::future<void> write_async(const Population<species_t> &population,
+                                         const std::string &path) {
+        auto copy = std::make_shared<Population<species_t>>(population.random.get_state());
+        copy->groups = population.groups;
+        return std::async(std::launch::async, [copy, path] {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file)
+                throw std::runtime_error("Cannot open snapshot file");
+            write(*copy, file);
+            file.close();
+            if (!file)
+                throw std::runtime_error("Cannot write snapshot");
+        });
+    }
+
+    // Reads population, arrays are read directly into their vectors
+    static Population<species_t> read(std::istream &is) {
+        header_t header;
+        if (!is.read(reinterpret_cast<char *>(&header), sizeof(header))
+            || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::invalid_argument("Not a population snapshot");
+        if (header.species_size != sizeof(species_t))
+            throw std::invalid_argument("Snapshot has different type of species");
+
+        Population<species_t> population(header.random_state);
+        for (size_t diet = 0; diet < DIETS; diet++) {
+            auto &group = population.groups[diet];
+            const size_t count = header.counts[diet];
+            if (count == 0)
+                continue;
+            // species_t may have no default constructor, so vector is filled
+            // with the first species before reading the rest over it
+            std::array<char, sizeof(species_t)> first;
+            if (!is.read(first.data(), first.size()))
+                throw std::invalid_argument("Snapshot is too short");
+            group.species.push_back(std::bit_cast<species_t>(first));
+            read_array(is, group.species, count - 1, group.species.front());
+            read_array(is, group.vitality, count, uint64_t(0));
+        }
+        return population;
+    }
+
+    static Population<species_t> read(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Cannot open snapshot file");
+        return read(file);
+    }
+};
+
+#endif /* POPULATION_SNAPSHOT_H */
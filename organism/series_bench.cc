@@ -0,0 +1,48 @@
+// Compile time benchmark of encounter_series. Builds a series of
+// SERIES_LENGTH organisms and evaluates it as a constant expression.
+// Measure build time for growing series with:
+//     for n in 10 100 1000; do
+//         echo $n; time g++ -std=c++20 -DSERIES_LENGTH=$n series_bench.cc -o series_bench
+//     done
+// Define SERIES_RUNTIME to evaluate the same series at runtime instead,
+// the difference of build times is the cost of constant evaluation.
+
+#include <cstddef>
+#include <cstdio>
+#include <utility>
+
+#include "organism.h"
+
+#ifndef SERIES_LENGTH
+#define SERIES_LENGTH 100
+#endif
+
+namespace {
+
+// Carnivore meets herbivores, plants and other carnivores in turn
+template <size_t index>
+constexpr auto organism_at() {
+    if constexpr (index % 3 == 0)
+        return Herbivore<int>(1, index % 7 + 1);
+    else if constexpr (index % 3 == 1)
+        return Plant<int>(2, index % 5 + 1);
+    else
+        return Carnivore<int>(3, index % 11 + 1);
+}
+
+template <size_t... indices>
+constexpr Carnivore<int> run_series(std::index_sequence<indices...>) {
+    return encounter_series(Carnivore<int>(0, 100), organism_at<indices>()...);
+}
+
+} // namespace
+
+int main() {
+#ifdef SERIES_RUNTIME
+    const Carnivore<int> result = run_series(std::make_index_sequence<SERIES_LENGTH>());
+#else
+    constexpr Carnivore<int> result = run_series(std::make_index_sequence<SERIES_LENGTH>());
+#endif
+    printf("%d arguments, vitality %lu\n", SERIES_LENGTH,
+           static_cast<unsigned long>(result.get_vitality()));
+}
@@ -0,0 +1,164 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Pool of threads running batches of independent tasks numbered 0, 1, ...
+// Tasks are split between workers in contiguous blocks, a worker takes tasks
+// from the back of its own queue and, when it runs out of them, steals from
+// the front of queues of other workers. The calling thread is worker 0.
+class work_stealing_pool_t
+{
+private:
+    struct worker_queue_t
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue_t>> queues;
+    std::vector<std::thread> threads;
+
+    // Current batch, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable batch_started;
+    std::condition_variable batch_finished;
+    const std::function<void(size_t, size_t)> *job = nullptr;
+    uint64_t batch = 0;
+    size_t running = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    std::optional<size_t> take_task(size_t worker) {
+        {
+            worker_queue_t &own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                const size_t task = own.tasks.back();
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            worker_queue_t &victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                const size_t task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Remaining tasks of a failed batch are dropped, so that other workers
+    // stop soon and the next batch does not run them
+    void drop_tasks() {
+        for (std::unique_ptr<worker_queue_t> &queue : queues) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->tasks.clear();
+        }
+    }
+
+    void work(size_t worker, const std::function<void(size_t, size_t)> &function) {
+        try {
+            while (std::optional<size_t> task = take_task(worker))
+                function(*task, worker);
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+            drop_tasks();
+        }
+    }
+
+    void worker_loop(size_t worker) {
+        uint64_t seen_batch = 0;
+        while (true) {
+            const std::function<void(size_t, size_t)> *function;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                batch_started.wait(lock, [&] { return stopping || batch != seen_batch; });
+                if (stopping)
+                    return;
+                seen_batch = batch;
+                function = job;
+            }
+            work(worker, *function);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--running == 0)
+                    batch_finished.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit work_stealing_pool_t(size_t workers = std::thread::hardware_concurrency()) {
+        if (workers == 0)
+            workers = 1;
+        for (size_t i = 0; i < workers; i++)
+            queues.push_back(std::make_unique<worker_queue_t>());
+        for (size_t i = 1; i < workers; i++)
+            threads.emplace_back(&work_stealing_pool_t::worker_loop, this, i);
+    }
+
+    work_stealing_pool_t(const work_stealing_pool_t &) = delete;
+    work_stealing_pool_t &operator=(const work_stealing_pool_t &) = delete;
+
+    ~work_stealing_pool_t() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        batch_started.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    size_t size() const { return queues.size(); }
+
+    // Calls function(task, worker) for each task from [0, tasks) and waits
+    // until all of them finish. Rethrows first exception thrown by function,
+    // tasks not started by then are not run.
+    void run(size_t tasks, const std::function<void(size_t, size_t)> &function) {
+        for (size_t worker = 0; worker < queues.size(); worker++) {
+            std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+            const size_t first = tasks * worker / queues.size();
+            const size_t last = tasks * (worker + 1) / queues.size();
+            for (size_t task = first; task < last; task++)
+                queues[worker]->tasks.push_back(task);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &function;
+            running = threads.size();
+            error = nullptr;
+            batch++;
+        }
+        batch_started.notify_all();
+
+        work(0, function);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        batch_finished.wait(lock, [&] { return running == 0; });
+        job = nullptr;
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+};
+
+#endif /* WORK_STEALING_POOL_H */